@@ -0,0 +1,31 @@
+#include "threadpool.hpp"
+#include "bench.hpp"
+#include <cstdlib>
+#include <cstring>
+
+/**
+*   ThreadPoolBench [--json] [--reps N] [--threads N] 
+*                   [--jobs N] [--filter NAME] [max_elements]
+*/
+int 
+main(int argc, char **argv) {
+    BenchConfig cfg;
+    for (int i = 1; i < argc; i++) {
+        std::string a(argv[i]);
+        bool value = i + 1 < argc;
+        if (a == "--json") cfg.json = true;
+        else if (a == "--csv") cfg.json = false;
+        else if (a == "--reps" && value) cfg.reps = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--threads" && value) cfg.threads = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--jobs" && value) cfg.jobs = std::max(8ull, std::strtoull(argv[++i], nullptr, 10));
+        else if (a == "--filter" && value) cfg.filter = argv[++i];
+        else if (!a.empty() && a[0] != '-') cfg.max_elements = std::strtoull(argv[i], nullptr, 10);
+        else {
+            std::cerr << "usage: " << argv[0] << " [--json|--csv] [--reps N] [--threads N]"
+                " [--jobs N] [--filter NAME] [max_elements]" << std::endl;
+            return 1;
+        }
+    }
+    bench_threadpool(cfg);
+    return 0;
+}
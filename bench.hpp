@@ -0,0 +1,413 @@
+#ifndef _THREAD_POOL_BENCH_HPP_
+#define _THREAD_POOL_BENCH_HPP_
+#ifdef __cplusplus
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+
+#ifndef _THREAD_POOL_HPP_
+#include "threadpool.hpp"
+#endif
+
+using namespace astp;
+
+/**
+*   One row of the results. *seconds* is the
+*   median of the repetitions and *min_seconds*
+*   the fastest, each repetition doing *ops*
+*   operations. *baseline* is the median of the
+*   sequential version, zero when there is none.
+*   Latencies are in microseconds over all the
+*   repetitions, zero when not measured.
+*/
+struct BenchResult
+{
+    BenchResult(const std::string &n = "", const std::string &m = "", int t = 0, int p = 1) :
+        name(n), mode(m), threads(t), producers(p), ops(0),
+        seconds(0), min_seconds(0), baseline(0),
+        p50_us(0), p90_us(0), p99_us(0), max_us(0) {};
+
+    std::string name;
+    std::string mode;
+    int threads;
+    int producers;
+    std::uint64_t ops;
+    double seconds;
+    double min_seconds;
+    double baseline;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+};
+
+/**
+*   What to run: every benchmark whose name
+*   contains *filter*, *reps* times after one
+*   warm up run, printed as CSV or JSON.
+*/
+struct BenchConfig
+{
+    BenchConfig() :
+        threads(std::max(1, hwc())), reps(5), jobs(1000000),
+        max_elements(10000000), json(false) {};
+
+    int threads;
+    int reps;
+    size_t jobs;
+    size_t max_elements;
+    std::string filter;
+    bool json;
+};
+
+/**
+*   Name printed in the results.
+*/
+std::string
+bench_mode_name(QueueMode mode) {
+    switch (mode) {
+    case QueueMode::WorkStealing: return "work_stealing";
+    case QueueMode::RingBuffer:   return "ring_buffer";
+    default:                      return "global";
+    }
+}
+
+/**
+*   Seconds spent by f.
+*/
+template<class F> double
+bench_seconds(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+*   Run f [which returns its own seconds, so
+*   the setup stays out] once to warm up, than
+*   *reps* times: fill the timing of *r*.
+*/
+template<class F> void
+bench_repeat(const BenchConfig &cfg, BenchResult &r, F&& f) {
+    f();
+    std::vector<double> s;
+    for (int i = 0; i < cfg.reps; i++) s.push_back(f());
+    std::sort(s.begin(), s.end());
+    r.seconds = s[s.size() / 2];
+    r.min_seconds = s.front();
+}
+
+/**
+*   Fill the latency percentiles of *r*
+*   from samples in microseconds.
+*/
+void
+bench_percentiles(std::vector<double> &us, BenchResult &r) {
+    if (us.empty()) return;
+    std::sort(us.begin(), us.end());
+    auto at = [&us](double p) { return us[static_cast<size_t>(p * (us.size() - 1))]; };
+    r.p50_us = at(0.50);
+    r.p90_us = at(0.90);
+    r.p99_us = at(0.99);
+    r.max_us = us.back();
+}
+
+double
+bench_us_since(std::chrono::steady_clock::time_point t) {
+    std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - t;
+    return d.count();
+}
+
+/**
+*   Many producers push tiny jobs at the
+*   same time, the clock stops when the
+*   pool has executed all of them. With one
+*   producer and empty jobs it measures the
+*   raw push-execute throughput.
+*/
+BenchResult
+bench_queue_throughput(const BenchConfig &cfg, QueueMode mode, int producers, bool empty) {
+    BenchResult r(empty ? "empty_tasks" : "contention", bench_mode_name(mode),
+        cfg.threads, producers);
+    int per_producer = static_cast<int>(cfg.jobs / producers);
+    r.ops = static_cast<std::uint64_t>(per_producer) * producers;
+    ThreadPool tp(cfg.threads, mode, 1 << 16);
+    std::atomic<int> counter(0);
+    bench_repeat(cfg, r, [&]() {
+        return bench_seconds([&]() {
+            auto prods = std::vector<std::thread>();
+            for (int p = 0; p < producers; p++) {
+                prods.push_back(std::thread([&tp, &counter, per_producer, empty]() {
+                    for (int i = 0; i < per_producer; i++) {
+                        if (empty) tp.push([]() {});
+                        else tp.push([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); });
+                    }
+                }));
+            }
+            for (auto &p : prods) p.join();
+            tp.wait();
+        });
+    });
+    return r;
+}
+
+/**
+*   Time from push to the start of the job.
+*   Hot: the next job is pushed as soon as
+*   the previous one ran, the threads are
+*   awake or spinning. Idle: the producer
+*   sleeps between pushes, so the threads
+*   park and the push has to wake one up.
+*/
+BenchResult
+bench_latency(const BenchConfig &cfg, QueueMode mode, bool idle) {
+    BenchResult r(idle ? "latency_idle" : "latency_hot", bench_mode_name(mode), cfg.threads);
+    r.ops = idle ? 500 : 20000;
+    ThreadPool tp(cfg.threads, mode);
+    std::vector<double> all;
+    bench_repeat(cfg, r, [&]() {
+        std::vector<double> us(r.ops);
+        auto s = bench_seconds([&]() {
+            for (size_t i = 0; i < r.ops; i++) {
+                std::atomic<bool> ran(false);
+                auto t = std::chrono::steady_clock::now();
+                tp.push([&us, &ran, i, t]() {
+                    us[i] = bench_us_since(t);
+                    ran.store(true, std::memory_order_release);
+                });
+                while (!ran.load(std::memory_order_acquire)) std::this_thread::yield();
+                if (idle) std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+        all.insert(all.end(), us.begin(), us.end());
+        return s;
+    });
+    bench_percentiles(all, r);
+    return r;
+}
+
+/**
+*   Fork-join: apply_for of one short job
+*   per thread [x4], again and again.
+*/
+BenchResult
+bench_fork_join(const BenchConfig &cfg, QueueMode mode) {
+    BenchResult r("fork_join", bench_mode_name(mode), cfg.threads);
+    r.ops = 2000;
+    ThreadPool tp(cfg.threads, mode);
+    std::atomic<long> sink(0);
+    bench_repeat(cfg, r, [&]() {
+        return bench_seconds([&]() {
+            for (size_t i = 0; i < r.ops; i++) {
+                tp.apply_for(cfg.threads * 4, [&sink]() {
+                    sink.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+        });
+    });
+    return r;
+}
+
+/**
+*   future_from_push and get, one at a time:
+*   the round trip of a result.
+*/
+BenchResult
+bench_future_roundtrip(const BenchConfig &cfg, QueueMode mode) {
+    BenchResult r("future_roundtrip", bench_mode_name(mode), cfg.threads);
+    r.ops = 20000;
+    ThreadPool tp(cfg.threads, mode);
+    std::vector<double> all;
+    bench_repeat(cfg, r, [&]() {
+        std::vector<double> us(r.ops);
+        auto s = bench_seconds([&]() {
+            for (size_t i = 0; i < r.ops; i++) {
+                auto t = std::chrono::steady_clock::now();
+                tp.future_from_push([i]() { return i; }).get();
+                us[i] = bench_us_since(t);
+            }
+        });
+        all.insert(all.end(), us.begin(), us.end());
+        return s;
+    });
+    bench_percentiles(all, r);
+    return r;
+}
+
+/**
+*   Dispatch group fan-out / fan-in: open a
+*   group, insert 64 jobs, close and wait.
+*/
+BenchResult
+bench_dg_fan(const BenchConfig &cfg, QueueMode mode) {
+    BenchResult r("dg_fan_out_in", bench_mode_name(mode), cfg.threads);
+    r.ops = 1000;
+    ThreadPool tp(cfg.threads, mode);
+    std::atomic<long> sink(0);
+    bench_repeat(cfg, r, [&]() {
+        return bench_seconds([&]() {
+            for (size_t i = 0; i < r.ops; i++) {
+                auto g = tp.dg_open();
+                for (int j = 0; j < 64; j++) {
+                    tp.dg_insert(g, [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); });
+                }
+                tp.dg_close(g);
+                tp.dg_wait(g);
+            }
+        });
+    });
+    return r;
+}
+
+/**
+*   Shrink to one thread and grow back while
+*   the pool runs jobs: ops counts the pairs
+*   of resizes.
+*/
+BenchResult
+bench_resize_churn(const BenchConfig &cfg, QueueMode mode) {
+    BenchResult r("resize_churn", bench_mode_name(mode), cfg.threads);
+    r.ops = 100;
+    ThreadPool tp(cfg.threads, mode);
+    std::atomic<long> sink(0);
+    bench_repeat(cfg, r, [&]() {
+        return bench_seconds([&]() {
+            for (size_t i = 0; i < r.ops; i++) {
+                tp.push_n(100, [&sink](size_t) {
+                    return [&sink]() { sink.fetch_add(1, std::memory_order_relaxed); };
+                });
+                tp.resize(1);
+                tp.resize(std::max(2, cfg.threads));
+            }
+            tp.wait();
+        });
+    });
+    return r;
+}
+
+/**
+*   parallel_sort against std::sort, and the
+*   parallel scans against std::partial_sum,
+*   from 1M elements up to *max_elements*
+*   [10x each step].
+*/
+template<class S> void
+bench_algorithms(const BenchConfig &cfg, S&& selected, std::vector<BenchResult> &out) {
+    ThreadPool tp(cfg.threads);
+    for (size_t n = 1000000; n <= cfg.max_elements; n *= 10) {
+        std::mt19937 rng(42);
+        std::vector<int> data(n);
+        for (auto &d : data) d = static_cast<int>(rng());
+        BenchResult base;
+
+        BenchResult sort("parallel_sort", "global", cfg.threads);
+        sort.ops = n;
+        if (selected(sort.name)) {
+            std::vector<int> v;
+            bench_repeat(cfg, base, [&]() {
+                v = data;
+                return bench_seconds([&v]() { std::sort(v.begin(), v.end()); });
+            });
+            bench_repeat(cfg, sort, [&]() {
+                v = data;
+                return bench_seconds([&tp, &v]() { parallel_sort(tp, v.begin(), v.end()); });
+            });
+            sort.baseline = base.seconds;
+            out.push_back(sort);
+        }
+
+        BenchResult scan("parallel_inclusive_scan", "global", cfg.threads);
+        scan.ops = n;
+        if (selected(scan.name)) {
+            std::vector<long long> in(data.begin(), data.end());
+            std::vector<long long> res(n);
+            bench_repeat(cfg, base, [&]() {
+                return bench_seconds([&in, &res]() { 
+                    std::partial_sum(in.begin(), in.end(), res.begin()); 
+                });
+            });
+            bench_repeat(cfg, scan, [&]() {
+                return bench_seconds([&tp, &in, &res]() {
+                    parallel_inclusive_scan(tp, in.begin(), in.end(), res.begin());
+                });
+            });
+            scan.baseline = base.seconds;
+            out.push_back(scan);
+        }
+    }
+}
+
+void
+bench_print_csv(std::ostream &os, const std::vector<BenchResult> &results) {
+    os << "name,mode,threads,producers,ops,seconds,min_seconds,ops_per_second,"
+        "baseline_seconds,speedup,p50_us,p90_us,p99_us,max_us" << std::endl;
+    for (auto &r : results) {
+        os << r.name << "," << r.mode << "," << r.threads << "," << r.producers << ","
+            << r.ops << "," << std::setprecision(6) << r.seconds << "," << r.min_seconds << ","
+            << std::fixed << std::setprecision(0) << r.ops / r.seconds << ","
+            << std::defaultfloat << std::setprecision(6) << r.baseline << ","
+            << (r.baseline > 0 ? r.baseline / r.seconds : 0) << ","
+            << r.p50_us << "," << r.p90_us << "," << r.p99_us << "," << r.max_us << std::endl;
+    }
+}
+
+void
+bench_print_json(std::ostream &os, const BenchConfig &cfg, const std::vector<BenchResult> &results) {
+    os << "{\"threads\":" << cfg.threads << ",\"reps\":" << cfg.reps << ",\"results\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        os << (i ? ",\n" : "\n") << "{\"name\":\"" << r.name << "\",\"mode\":\"" << r.mode
+            << "\",\"threads\":" << r.threads << ",\"producers\":" << r.producers
+            << ",\"ops\":" << r.ops << std::setprecision(6)
+            << ",\"seconds\":" << r.seconds << ",\"min_seconds\":" << r.min_seconds
+            << ",\"ops_per_second\":" << std::fixed << std::setprecision(0) << r.ops / r.seconds
+            << std::defaultfloat << std::setprecision(6)
+            << ",\"baseline_seconds\":" << r.baseline
+            << ",\"speedup\":" << (r.baseline > 0 ? r.baseline / r.seconds : 0)
+            << ",\"p50_us\":" << r.p50_us << ",\"p90_us\":" << r.p90_us
+            << ",\"p99_us\":" << r.p99_us << ",\"max_us\":" << r.max_us << "}";
+    }
+    os << "\n]}" << std::endl;
+}
+
+/**
+*   Run the benchmarks selected by *cfg* for
+*   each queue mode, than the algorithms, and
+*   print the results on *os*.
+*/
+void
+bench_threadpool(const BenchConfig &cfg = BenchConfig(), std::ostream &os = std::cout) {
+    QueueMode modes[] = { QueueMode::Global, QueueMode::WorkStealing, QueueMode::RingBuffer };
+    std::vector<BenchResult> results;
+    auto selected = [&cfg](const std::string &name) {
+        return name.find(cfg.filter) != std::string::npos;
+    };
+    for (auto m : modes) {
+        if (selected("empty_tasks")) results.push_back(bench_queue_throughput(cfg, m, 1, true));
+        if (selected("contention")) {
+            for (int p : { 1, 2, 4, 8 }) results.push_back(bench_queue_throughput(cfg, m, p, false));
+        }
+        if (selected("latency_hot")) results.push_back(bench_latency(cfg, m, false));
+        if (selected("latency_idle")) results.push_back(bench_latency(cfg, m, true));
+        if (selected("fork_join")) results.push_back(bench_fork_join(cfg, m));
+        if (selected("future_roundtrip")) results.push_back(bench_future_roundtrip(cfg, m));
+        if (selected("dg_fan_out_in")) results.push_back(bench_dg_fan(cfg, m));
+        if (selected("resize_churn")) results.push_back(bench_resize_churn(cfg, m));
+    }
+    bench_algorithms(cfg, selected, results);
+    if (cfg.json) bench_print_json(os, cfg, results);
+    else bench_print_csv(os, results);
+}
+
+#endif // __cplusplus
+#endif // _THREAD_POOL_BENCH_HPP_
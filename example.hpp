@@ -90,6 +90,23 @@ example_inline_code_and_save_vec(int number) {
 }
 
 
+//#############################################################################
+//#############################################################################
+
+
+/**
+*   The same kind of work of the example above,
+*   reduced without any shared container or lock.
+*/
+void 
+example_parallel_reduce(int number) {
+    long sum = tp.parallel_transform_reduce(0, number, 0L, 
+        [](long a, long b) { return a + b; },
+        [](int i) { return 2L * i; });
+    std::cout << "Sum of doubles: " << sum << std::endl;
+}
+
+
 //#############################################################################
 //#############################################################################
 
@@ -0,0 +1,105 @@
+#include "threadpool.hpp"
+#include "replay.hpp"
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+
+/**
+*   Run a synthetic workload [bursts of jobs,
+*   some in dispatch groups, random priorities]
+*   on a traced pool and return its task trace.
+*   Without TP_ENABLE_TRACING the synthetic 
+*   trace itself is returned.
+*/
+std::vector<TaskTraceRecord>
+replay_record(size_t n, int threads) {
+    auto jobs = replay_synthetic(n);
+    #if TP_ENABLE_TRACING
+    ThreadPool tp(threads);
+    tp.enable_tracing();
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs.size();) {
+        auto at = t0 + std::chrono::nanoseconds(jobs[i].arrival_ns);
+        std::this_thread::sleep_until(at);
+        if (jobs[i].group != 0) {
+            auto g = tp.dg_open();
+            for (auto group = jobs[i].group; i < jobs.size() && jobs[i].group == group; i++) {
+                auto d = jobs[i].duration_ns;
+                tp.dg_insert(g, [d]() { replay_spin(d); });
+            }
+            tp.dg_close(g);
+        } else {
+            auto d = jobs[i].duration_ns;
+            tp.push(jobs[i].priority, [d]() { replay_spin(d); });
+            i++;
+        }
+    }
+    tp.wait();
+    jobs = tp.task_trace();
+    tp.disable_tracing();
+    #else
+    (void) threads;
+    #endif
+    return jobs;
+}
+
+/**
+*   ThreadPoolReplay record FILE [--jobs N] [--threads N]
+*   ThreadPoolReplay replay FILE [--threads N] [--pool] 
+*                    [--speed X] [--json]
+*/
+int 
+main(int argc, char **argv) {
+    if (argc < 3 || (std::strcmp(argv[1], "record") != 0 && std::strcmp(argv[1], "replay") != 0)) {
+        std::cerr << "usage: " << argv[0] << " record FILE [--jobs N] [--threads N]\n"
+            "       " << argv[0] << " replay FILE [--threads N] [--pool] [--speed X] [--json]" 
+            << std::endl;
+        return 1;
+    }
+    std::string cmd(argv[1]), path(argv[2]);
+    size_t n = 20000;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool pool = false, json = false;
+    double speed = 1.0;
+    for (int i = 3; i < argc; i++) {
+        std::string a(argv[i]);
+        bool value = i + 1 < argc;
+        if (a == "--jobs" && value) n = std::max(1ull, std::strtoull(argv[++i], nullptr, 10));
+        else if (a == "--threads" && value) threads = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--speed" && value) speed = std::max(0.01, std::atof(argv[++i]));
+        else if (a == "--pool") pool = true;
+        else if (a == "--json") json = true;
+        else {
+            std::cerr << "unknown option " << a << std::endl;
+            return 1;
+        }
+    }
+    if (cmd == "record") {
+        auto jobs = replay_record(n, threads);
+        std::ofstream out(path, std::ios::binary);
+        task_trace_write(out, jobs);
+        if (!out) {
+            std::cerr << "cannot write " << path << std::endl;
+            return 1;
+        }
+        std::cerr << "recorded " << jobs.size() << " jobs in " << path << std::endl;
+        return 0;
+    }
+    std::vector<TaskTraceRecord> jobs;
+    std::ifstream in(path, std::ios::binary);
+    if (!task_trace_read(in, jobs)) {
+        std::cerr << path << " is not a task trace" << std::endl;
+        return 1;
+    }
+    std::vector<ReplayReport> reports;
+    ReplayPolicy policies[] = { ReplayPolicy::Fifo, ReplayPolicy::Priority, 
+        ReplayPolicy::Lifo, ReplayPolicy::ShortestFirst };
+    for (auto p : policies) reports.push_back(replay_simulate(jobs, threads, p));
+    if (pool) {
+        QueueMode modes[] = { QueueMode::Global, QueueMode::WorkStealing, QueueMode::RingBuffer };
+        for (auto m : modes) reports.push_back(replay_on_pool(jobs, threads, m, speed));
+    }
+    if (json) replay_print_json(std::cout, reports);
+    else replay_print_csv(std::cout, reports);
+    return 0;
+}
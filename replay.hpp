@@ -0,0 +1,321 @@
+#ifndef _THREAD_POOL_REPLAY_HPP_
+#define _THREAD_POOL_REPLAY_HPP_
+#ifdef __cplusplus
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+#ifndef _THREAD_POOL_HPP_
+#include "threadpool.hpp"
+#endif
+
+using namespace astp;
+
+/**
+*   How a replayed trace was served. The wait
+*   is from arrival to start; a group latency
+*   from the arrival of its first job to the
+*   end of its last one. Utilization is the
+*   busy time over threads x makespan.
+*/
+struct ReplayReport
+{
+    ReplayReport(const std::string &s = "", int t = 0) :
+        scheduler(s), threads(t), jobs(0), groups(0),
+        makespan_seconds(0), jobs_per_second(0), utilization(0),
+        wait_p50_us(0), wait_p90_us(0), wait_p99_us(0), wait_max_us(0),
+        group_p50_us(0), group_p99_us(0) {};
+
+    std::string scheduler;
+    int threads;
+    std::uint64_t jobs;
+    std::uint64_t groups;
+    double makespan_seconds;
+    double jobs_per_second;
+    double utilization;
+    double wait_p50_us;
+    double wait_p90_us;
+    double wait_p99_us;
+    double wait_max_us;
+    double group_p50_us;
+    double group_p99_us;
+};
+
+/**
+*   Scheduler policies of the simulator.
+*   Fifo is the Global queue without levels,
+*   Priority the Global queue [levels with
+*   aging], Lifo serves the newest job first,
+*   ShortestFirst the shortest one, knowing the
+*   durations in advance [a lower bound for the
+*   mean wait].
+*/
+enum class ReplayPolicy
+{
+    Fifo,
+    Priority,
+    Lifo,
+    ShortestFirst
+};
+
+std::string
+replay_policy_name(ReplayPolicy p) {
+    switch (p) {
+    case ReplayPolicy::Priority:      return "sim_priority";
+    case ReplayPolicy::Lifo:          return "sim_lifo";
+    case ReplayPolicy::ShortestFirst: return "sim_shortest_first";
+    default:                          return "sim_fifo";
+    }
+}
+
+/**
+*   Fill the report from the start and end of
+*   each job, in ns from the start of the trace.
+*/
+void
+replay_summarize(const std::vector<TaskTraceRecord> &jobs, const std::vector<std::uint64_t> &start,
+    const std::vector<std::uint64_t> &end, ReplayReport &r) {
+    r.jobs = jobs.size();
+    if (jobs.empty()) return;
+    std::vector<double> wait;
+    std::map<std::uint32_t, std::pair<std::uint64_t, std::uint64_t> > groups;
+    std::uint64_t last = 0, busy = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        wait.push_back((start[i] - std::min(start[i], jobs[i].arrival_ns)) / 1000.0);
+        last = std::max(last, end[i]);
+        busy += end[i] - start[i];
+        if (jobs[i].group == 0) continue;
+        auto it = groups.find(jobs[i].group);
+        if (it == groups.end()) groups[jobs[i].group] = std::make_pair(jobs[i].arrival_ns, end[i]);
+        else {
+            it->second.first = std::min(it->second.first, jobs[i].arrival_ns);
+            it->second.second = std::max(it->second.second, end[i]);
+        }
+    }
+    auto pct = [](std::vector<double> &v, double p) {
+        return v.empty() ? 0 : v[static_cast<size_t>(p * (v.size() - 1))];
+    };
+    std::sort(wait.begin(), wait.end());
+    r.wait_p50_us = pct(wait, 0.50);
+    r.wait_p90_us = pct(wait, 0.90);
+    r.wait_p99_us = pct(wait, 0.99);
+    r.wait_max_us = wait.back();
+    std::vector<double> lat;
+    for (auto &g : groups) lat.push_back((g.second.second - g.second.first) / 1000.0);
+    std::sort(lat.begin(), lat.end());
+    r.groups = groups.size();
+    r.group_p50_us = pct(lat, 0.50);
+    r.group_p99_us = pct(lat, 0.99);
+    r.makespan_seconds = last / 1e9;
+    if (last > 0) {
+        r.jobs_per_second = r.jobs / r.makespan_seconds;
+        r.utilization = static_cast<double>(busy) / (static_cast<double>(last) * r.threads);
+    }
+}
+
+/**
+*   Discrete event simulation of *threads*
+*   workers serving the trace with *policy*,
+*   with no scheduling overhead: arrivals and
+*   durations are taken from the trace.
+*/
+ReplayReport
+replay_simulate(const std::vector<TaskTraceRecord> &jobs, int threads, ReplayPolicy policy) {
+    ReplayReport r(replay_policy_name(policy), threads);
+    std::vector<std::uint64_t> start(jobs.size()), end(jobs.size());
+    std::deque<size_t> fifo;
+    std::deque<size_t> levels[4];
+    int skipped[4] = { 0, 0, 0, 0 };
+    auto longer = [&jobs](size_t a, size_t b) {
+        return jobs[a].duration_ns != jobs[b].duration_ns ?
+            jobs[a].duration_ns > jobs[b].duration_ns : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(longer)> shortest(longer);
+    size_t ready = 0;
+    auto push = [&](size_t i) {
+        ++ready;
+        if (policy == ReplayPolicy::Priority) levels[static_cast<int>(jobs[i].priority)].push_back(i);
+        else if (policy == ReplayPolicy::ShortestFirst) shortest.push(i);
+        else fifo.push_back(i);
+    };
+    auto pop = [&]() -> size_t {
+        --ready;
+        size_t i;
+        if (policy == ReplayPolicy::Priority) {
+            int top = 3;
+            while (levels[top].empty()) --top;
+            int served = top;
+            for (int l = top - 1; l >= 0; --l) {
+                if (levels[l].empty()) continue;
+                if (++skipped[l] >= TP_PRIORITY_AGING && served == top) served = l;
+            }
+            skipped[served] = 0;
+            i = levels[served].front();
+            levels[served].pop_front();
+        } else if (policy == ReplayPolicy::ShortestFirst) {
+            i = shortest.top();
+            shortest.pop();
+        } else if (policy == ReplayPolicy::Lifo) {
+            i = fifo.back();
+            fifo.pop_back();
+        } else {
+            i = fifo.front();
+            fifo.pop_front();
+        }
+        return i;
+    };
+    std::priority_queue<std::uint64_t, std::vector<std::uint64_t>, std::greater<std::uint64_t> > busy;
+    int idle = threads;
+    size_t next = 0;
+    while (next < jobs.size() || !busy.empty()) {
+        std::uint64_t now;
+        if (next < jobs.size() && (busy.empty() || jobs[next].arrival_ns <= busy.top())) {
+            now = jobs[next].arrival_ns;
+            push(next++);
+        } else {
+            now = busy.top();
+            busy.pop();
+            ++idle;
+        }
+        while (idle > 0 && ready != 0) {
+            auto i = pop();
+            start[i] = now;
+            end[i] = now + jobs[i].duration_ns;
+            busy.push(end[i]);
+            --idle;
+        }
+    }
+    replay_summarize(jobs, start, end, r);
+    return r;
+}
+
+/**
+*   Spin for *ns* nanoseconds, the stand-in
+*   of a job of the trace.
+*/
+void
+replay_spin(std::uint64_t ns) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < until) {}
+}
+
+/**
+*   Replay the trace on a real pool: one
+*   producer pushes each job at its arrival
+*   time [scaled by 1 / *speed*] with its
+*   priority, each job spins for its duration.
+*/
+ReplayReport
+replay_on_pool(const std::vector<TaskTraceRecord> &jobs, int threads, QueueMode mode,
+    double speed = 1.0) {
+    ReplayReport r(mode == QueueMode::WorkStealing ? "pool_work_stealing" :
+        mode == QueueMode::RingBuffer ? "pool_ring_buffer" : "pool_global", threads);
+    std::vector<std::uint64_t> start(jobs.size()), end(jobs.size());
+    std::vector<TaskTraceRecord> timed(jobs);
+    {
+        ThreadPool tp(threads, mode);
+        auto t0 = std::chrono::steady_clock::now();
+        auto since = [t0]() {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count());
+        };
+        for (size_t i = 0; i < jobs.size(); i++) {
+            auto at = static_cast<std::uint64_t>(jobs[i].arrival_ns / speed);
+            for (auto now = since(); now < at; now = since()) {
+                if (at - now > 200000) std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            timed[i].arrival_ns = since();
+            auto d = jobs[i].duration_ns;
+            tp.push(jobs[i].priority, [&start, &end, &since, i, d]() {
+                start[i] = since();
+                replay_spin(d);
+                end[i] = since();
+            });
+        }
+        tp.wait();
+    }
+    replay_summarize(timed, start, end, r);
+    return r;
+}
+
+/**
+*   Synthetic trace: *n* jobs in bursts, some
+*   of them dispatch groups, with exponential
+*   durations [mean *mean_us*] and a random
+*   priority. Used when there is no recorded
+*   trace at hand.
+*/
+std::vector<TaskTraceRecord>
+replay_synthetic(size_t n, double mean_us = 20, std::uint32_t seed = 42) {
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> duration(1.0 / mean_us);
+    std::exponential_distribution<double> gap(1.0 / (4 * mean_us));
+    std::uniform_int_distribution<int> burst(1, 64);
+    std::uniform_int_distribution<int> prio(0, 9);
+    std::vector<TaskTraceRecord> jobs;
+    std::uint64_t t = 0;
+    std::uint32_t group = 0;
+    while (jobs.size() < n) {
+        t += static_cast<std::uint64_t>(gap(rng) * 1000 * 8);
+        int b = burst(rng);
+        bool grouped = b > 16;
+        if (grouped) ++group;
+        for (int k = 0; k < b && jobs.size() < n; k++) {
+            TaskTraceRecord j;
+            j.arrival_ns = t + k * 200;
+            j.duration_ns = static_cast<std::uint64_t>(duration(rng) * 1000) + 100;
+            j.group = grouped ? group : 0;
+            int p = prio(rng);
+            j.priority = p == 0 ? Priority::Low : p < 8 ? Priority::Normal :
+                p < 9 ? Priority::High : Priority::Critical;
+            jobs.push_back(j);
+        }
+    }
+    return jobs;
+}
+
+void
+replay_print_csv(std::ostream &os, const std::vector<ReplayReport> &reports) {
+    os << "scheduler,threads,jobs,groups,makespan_seconds,jobs_per_second,utilization,"
+        "wait_p50_us,wait_p90_us,wait_p99_us,wait_max_us,group_p50_us,group_p99_us" << std::endl;
+    for (auto &r : reports) {
+        os << r.scheduler << "," << r.threads << "," << r.jobs << "," << r.groups << ","
+            << std::setprecision(6) << r.makespan_seconds << "," << r.jobs_per_second << ","
+            << r.utilization << "," << r.wait_p50_us << "," << r.wait_p90_us << ","
+            << r.wait_p99_us << "," << r.wait_max_us << "," << r.group_p50_us << ","
+            << r.group_p99_us << std::endl;
+    }
+}
+
+void
+replay_print_json(std::ostream &os, const std::vector<ReplayReport> &reports) {
+    os << "{\"results\":[";
+    for (size_t i = 0; i < reports.size(); i++) {
+        auto &r = reports[i];
+        os << (i ? ",\n" : "\n") << std::setprecision(6) << "{\"scheduler\":\"" << r.scheduler
+            << "\",\"threads\":" << r.threads << ",\"jobs\":" << r.jobs
+            << ",\"groups\":" << r.groups << ",\"makespan_seconds\":" << r.makespan_seconds
+            << ",\"jobs_per_second\":" << r.jobs_per_second
+            << ",\"utilization\":" << r.utilization
+            << ",\"wait_p50_us\":" << r.wait_p50_us << ",\"wait_p90_us\":" << r.wait_p90_us
+            << ",\"wait_p99_us\":" << r.wait_p99_us << ",\"wait_max_us\":" << r.wait_max_us
+            << ",\"group_p50_us\":" << r.group_p50_us
+            << ",\"group_p99_us\":" << r.group_p99_us << "}";
+    }
+    os << "\n]}" << std::endl;
+}
+
+#endif // __cplusplus
+#endif // _THREAD_POOL_REPLAY_HPP_
@@ -5,6 +5,11 @@
 #include <iostream>
 #include <stdlib.h>     
 #include <time.h>  
+#include <chrono>
+#include <array>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include "cppunit/TestCase.h"
 #include "cppunit/TestCaller.h"
 #include "cppunit/TestResult.h"
@@ -56,6 +61,34 @@ public:
         CPPUNIT_ASSERT( tp->pool_size() == s );
     }
 
+    void
+    testRetire() {
+        ThreadPool rt(2);
+        std::atomic<bool> started(false), release(false);
+        std::atomic<int> c(0);
+        rt.push([&]() {
+            started = true;
+            while (!release) std::this_thread::yield();
+            ++c;
+        });
+        while (!started) std::this_thread::yield();
+        rt.resize(1);
+        rt.resize(3);
+        rt.resize(1);
+        CPPUNIT_ASSERT( rt.pool_size() == 1 );
+        for (int i = 0; i < 100; i++) rt.push([&c](){ ++c; });
+        release = true;
+        rt.wait();
+        CPPUNIT_ASSERT( c == 101 );
+        rt.push([&rt, &c]() { rt.stop(); ++c; });
+        while (c != 102) std::this_thread::yield();
+        CPPUNIT_ASSERT( rt.pool_size() == 0 );
+        rt.awake();
+        rt.push([&c](){ ++c; });
+        rt.wait();
+        CPPUNIT_ASSERT( c == 103 );
+    }
+
     void
     testPush() {
         tp->stop();
@@ -86,6 +119,90 @@ public:
         CPPUNIT_ASSERT( tp->queue_size() == r );
     }
 
+    void
+    testPushBulk() {
+        std::atomic<int> c(0);
+        int r = random(1, 1000);
+        std::vector<std::function<void()>> jobs(r, [&c](){ ++c; });
+        tp->push_bulk(jobs.begin(), jobs.end());
+        tp->push_n(r, [&c](size_t i) { return [&c, i](){ c += static_cast<int>(i); }; });
+        auto a = [&c](){ ++c; };
+        tp->push(a, a, [&c](){ ++c; });
+        tp->wait();
+        CPPUNIT_ASSERT( c == r + r * (r - 1) / 2 + 3 );
+
+        ThreadPool ws(4, QueueMode::WorkStealing);
+        ThreadPool rb(4, QueueMode::RingBuffer, 16);
+        std::atomic<int> d(0);
+        ws.push([&ws, &d]() {
+            ws.push_n(1000, [&d](size_t) { return [&d](){ ++d; }; });
+        });
+        rb.push_n(1000, [&d](size_t) { return [&d](){ ++d; }; });
+        ws.wait();
+        rb.wait();
+        CPPUNIT_ASSERT( d == 2000 );
+    }
+
+    void
+    testPushBulkStopped() {
+        tp->stop();
+        int r = random(1, 1000);
+        std::vector<Task> jobs;
+        for (int i = 0; i < r; i++) jobs.push_back(Task([](){}));
+        tp->push_bulk(jobs.begin(), jobs.end());
+        CPPUNIT_ASSERT( tp->queue_size() == r );
+        CPPUNIT_ASSERT( !jobs.front() );
+    }
+
+    void
+    testCpulist() {
+        std::vector<int> cpus;
+        CPPUNIT_ASSERT( cpulist_parse("0-3,8,10-14:2\n", cpus) );
+        CPPUNIT_ASSERT( cpus == std::vector<int>({0, 1, 2, 3, 8, 10, 12, 14}) );
+        CPPUNIT_ASSERT( cpulist_parse("", cpus) && cpus.empty() );
+        CPPUNIT_ASSERT( !cpulist_parse("3-1", cpus) );
+        CPPUNIT_ASSERT( !cpulist_parse("1,,2", cpus) );
+        CPPUNIT_ASSERT( !cpulist_parse("a", cpus) );
+        auto nodes = numa_topology();
+        CPPUNIT_ASSERT( !nodes.empty() && !nodes[0].empty() );
+        bool thrown = false;
+        try {
+            tp->set_affinity(Affinity::Cores, "0-");
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+        CPPUNIT_ASSERT( tp->affinity() == Affinity::None );
+    }
+
+    void
+    testAffinity() {
+        ThreadPool pin(2);
+        int cpu = numa_topology()[0][0];
+        bool pinned = pin.set_affinity(Affinity::Cores, std::to_string(cpu));
+        CPPUNIT_ASSERT( pin.affinity() == Affinity::Cores );
+        std::atomic<int> c(0), wrong(0);
+        for (int i = 0; i < 100; i++) {
+            pin.push_on_node(i, [&c, &wrong, cpu, pinned]() {
+                #if TP_ENABLE_AFFINITY
+                if (pinned && sched_getcpu() != cpu) ++wrong;
+                #endif
+                ++c;
+            });
+        }
+        pin.resize(3);
+        pin.push_on_node(-1, [&c](){ ++c; });
+        pin.wait();
+        CPPUNIT_ASSERT( c == 101 );
+        CPPUNIT_ASSERT( wrong == 0 );
+        CPPUNIT_ASSERT( pin.numa_nodes() == static_cast<int>(numa_topology().size()) );
+        pin.set_affinity(Affinity::NumaNodes);
+        pin.set_affinity(Affinity::None);
+        pin.stop();
+        pin.push_on_node(0, [](){});
+        CPPUNIT_ASSERT( pin.queue_size() == 1 );
+    }
+
     void
     testApplyFor() {
         try {
@@ -113,6 +230,137 @@ public:
         CPPUNIT_ASSERT( fut.get() == r );
     }
 
+    void
+    testTask() {
+        int a = 0;
+        Task small([&a]() { a += 1; });
+        CPPUNIT_ASSERT( small.is_inline() );
+        std::array<int, 64> big;
+        big.fill(1);
+        Task large([big, &a]() { a += big[0]; });
+        CPPUNIT_ASSERT( !large.is_inline() );
+        Task moved(std::move(small));
+        CPPUNIT_ASSERT( !small && moved );
+        moved();
+        large();
+        CPPUNIT_ASSERT( a == 2 );
+    }
+
+    void
+    testPushMoveOnly() {
+        std::unique_ptr<int> p(new int(random(1, 1000)));
+        int expected = *p;
+        std::atomic<int> v(0);
+        tp->push(MoveOnlyJob(std::move(p), &v));
+        tp->wait();
+        CPPUNIT_ASSERT( v == expected );
+    }
+
+    void
+    testFutureMoveOnly() {
+        std::unique_ptr<int> p(new int(random(1, 1000)));
+        int expected = *p;
+        auto fut = tp->future_from_push(MoveOnlyJob(std::move(p), nullptr));
+        CPPUNIT_ASSERT( fut.get() == expected );
+    }
+
+    void
+    testWorkStealing() {
+        ThreadPool ws(4, QueueMode::WorkStealing);
+        CPPUNIT_ASSERT( ws.queue_mode() == QueueMode::WorkStealing );
+        std::atomic<int> c(0);
+        int r = random(1, 1000);
+        for (int i = 0; i < r; i++) {
+            ws.push([&ws, &c]() {
+                ++c;
+                for (int k = 0; k < 10; k++) {
+                    ws.push([&c](){ ++c; });
+                }
+            });
+        }
+        ws.wait();
+        CPPUNIT_ASSERT( c == r * 11 );
+        CPPUNIT_ASSERT( ws.queue_size() == 0 );
+    }
+
+    void
+    testWorkStealingResize() {
+        ThreadPool ws(4, QueueMode::WorkStealing);
+        std::atomic<int> c(0);
+        for (int i = 0; i < 100; i++) {
+            ws.push([&ws, &c]() {
+                for (int k = 0; k < 100; k++) {
+                    ws.push([&c](){ ++c; });
+                }
+            });
+        }
+        ws.resize(1);
+        ws.resize(3);
+        ws.wait();
+        CPPUNIT_ASSERT( c == 100 * 100 );
+    }
+
+    void
+    testRingBuffer() {
+        ThreadPool rb(4, QueueMode::RingBuffer, 16);
+        std::atomic<int> c(0);
+        auto producers = std::vector<std::thread>();
+        for (int p = 0; p < 4; p++) {
+            producers.push_back(std::thread([&rb, &c]() {
+                for (int i = 0; i < 1000; i++) {
+                    rb.push([&c](){ ++c; });
+                }
+            }));
+        }
+        for (auto &p : producers) p.join();
+        rb.wait();
+        CPPUNIT_ASSERT( c == 4000 );
+        CPPUNIT_ASSERT( rb.queue_size() == 0 );
+    }
+
+    void
+    testRingBufferOverflow() {
+        ThreadPool rb(4, QueueMode::RingBuffer, 16);
+        rb.stop();
+        std::atomic<int> c(0);
+        int r = random(1, 1000);
+        for (int i = 0; i < r; i++) {
+            rb.push([&c](){ ++c; });
+        }
+        CPPUNIT_ASSERT( rb.queue_size() == r );
+        rb.awake();
+        rb.wait();
+        CPPUNIT_ASSERT( c == r );
+    }
+
+    void
+    testWaitDoesNotPoll() {
+        #if !TP_ENABLE_LEGACY_SLEEP_WAIT
+        tp->set_sleep_time_s(1);
+        std::atomic<int> c(0);
+        auto start = std::chrono::steady_clock::now();
+        for (int k = 0; k < 10; k++) {
+            tp->push([&c](){ ++c; });
+            tp->wait();
+            tp->apply_for(4, [&c](){ ++c; });
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        CPPUNIT_ASSERT( c == 50 );
+        CPPUNIT_ASSERT( elapsed < std::chrono::milliseconds(500) );
+        #endif
+    }
+
+    void
+    testApplyForThrow() {
+        #if !TP_ENABLE_LEGACY_SLEEP_WAIT
+        std::atomic<int> c(0);
+        tp->apply_for(8, [&c](){ 
+            if (++c % 2 == 0) throw std::runtime_error("odd");
+        });
+        CPPUNIT_ASSERT( c == 8 );
+        #endif
+    }
+
     void
     testSleepTime() {
         try {
@@ -126,6 +374,480 @@ public:
         } catch (std::runtime_error e) {}
     }
 
+    void
+    testSpinBudget() {
+        bool thrown = false;
+        try {
+            tp->set_spin_budget(-1);
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+        ThreadPool sp(4);
+        sp.set_spin_budget(1 << 14);
+        CPPUNIT_ASSERT( sp.spin_budget() == 1 << 14 );
+        std::atomic<int> c(0);
+        for (int i = 0; i < 200; i++) {
+            sp.push([&c](){ ++c; });
+            if (i % 10 == 0) std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        sp.push_n(100, [&c](size_t) { return [&c](){ ++c; }; });
+        sp.wait();
+        CPPUNIT_ASSERT( c == 300 );
+        sp.set_spin_budget(0);
+        sp.push([&c](){ ++c; });
+        sp.wait();
+        CPPUNIT_ASSERT( c == 301 );
+    }
+
+    void
+    testStats() {
+        ThreadPool st(2);
+        auto s0 = st.stats();
+        CPPUNIT_ASSERT( s0.threads == 2 && s0.workers.size() == 2 );
+        CPPUNIT_ASSERT( s0.total.executed == 0 );
+        std::atomic<int> c(0);
+        st.push_n(100, [&c](size_t) { return [&c](){ ++c; }; });
+        st.wait();
+        st.resize(1);
+        for (int i = 0; i < 10; i++) {
+            st.push([&c]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ++c;
+            });
+        }
+        st.wait();
+        st.stop();
+        auto s = st.stats();
+        CPPUNIT_ASSERT( c == 110 );
+        CPPUNIT_ASSERT( s.threads == 0 && s.workers.empty() );
+        CPPUNIT_ASSERT( s.total.executed == 110 );
+        #if TP_ENABLE_METRICS
+        CPPUNIT_ASSERT( s.queue_wait.count() == 110 );
+        CPPUNIT_ASSERT( s.run_time.count() == 110 );
+        CPPUNIT_ASSERT( s.run_time.percentile(1.0) >= 1000000 );
+        CPPUNIT_ASSERT( s.queue_high_water >= 1 );
+        CPPUNIT_ASSERT( s.total.idle_ns >= s.total.park_ns );
+        #else
+        CPPUNIT_ASSERT( s.queue_wait.count() == 0 && s.total.parks == 0 );
+        #endif
+
+        LatencyHistogram h;
+        CPPUNIT_ASSERT( h.percentile(0.5) == 0 );
+        h.buckets[0] = 1;
+        h.buckets[10] = 3;
+        CPPUNIT_ASSERT( h.percentile(0.0) == 1 && h.percentile(0.25) == 1 );
+        CPPUNIT_ASSERT( h.percentile(0.5) == 2047 && h.percentile(1.0) == 2047 );
+        CPPUNIT_ASSERT( LatencyHistogram::bucket(1024) == 10 );
+    }
+
+    void
+    testTracing() {
+        ThreadPool tr(2);
+        std::ostringstream empty;
+        CPPUNIT_ASSERT( tr.dump_trace(empty) );
+        CPPUNIT_ASSERT( empty.str().find("{\"traceEvents\":[") == 0 );
+        std::atomic<int> c(0);
+        #if TP_ENABLE_TRACING
+        CPPUNIT_ASSERT( tr.enable_tracing() && tr.tracing_enabled() );
+        tr.push(TraceLabel("labeled \"job\""), [&c](){ ++c; });
+        for (int i = 0; i < 20; i++) tr.push([&c](){ ++c; });
+        tr.dg_open("g1");
+        tr.dg_insert("g1", [&c](){ ++c; });
+        tr.dg_close("g1");
+        tr.dg_wait("g1");
+        tr.stop();
+        tr.disable_tracing();
+        CPPUNIT_ASSERT( !tr.tracing_enabled() );
+        std::ostringstream os;
+        CPPUNIT_ASSERT( tr.dump_trace(os) );
+        auto json = os.str();
+        size_t runs = 0;
+        for (auto p = json.find("\"cat\":\"task\",\"ph\":\"X\""); p != std::string::npos; 
+            p = json.find("\"cat\":\"task\",\"ph\":\"X\"", p + 1)) ++runs;
+        CPPUNIT_ASSERT( runs == 22 );
+        CPPUNIT_ASSERT( json.find("\"name\":\"labeled \\\"job\\\"\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"ph\":\"s\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"ph\":\"f\",\"pid\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"name\":\"dg_open\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"name\":\"dg_close\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"name\":\"dg_finish\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"group\":\"g1\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.find("\"thread_name\"") != std::string::npos );
+        CPPUNIT_ASSERT( json.rfind("],\"displayTimeUnit\":\"ns\"}") != std::string::npos );
+        #else
+        CPPUNIT_ASSERT( !tr.enable_tracing() && !tr.tracing_enabled() );
+        tr.push(TraceLabel("job"), [&c](){ ++c; });
+        tr.wait();
+        CPPUNIT_ASSERT( c == 1 );
+        #endif
+    }
+
+    void
+    testTaskTrace() {
+        std::vector<TaskTraceRecord> jobs(3), back;
+        jobs[1].arrival_ns = 300; jobs[1].wait_ns = 1u << 20; jobs[1].group = 7;
+        jobs[2].arrival_ns = 1ull << 40; jobs[2].duration_ns = 129; 
+        jobs[2].priority = Priority::Critical;
+        std::stringstream ss;
+        task_trace_write(ss, jobs);
+        CPPUNIT_ASSERT( task_trace_read(ss, back) && back.size() == 3 );
+        CPPUNIT_ASSERT( back[1].arrival_ns == 300 && back[1].wait_ns == 1u << 20 && back[1].group == 7 );
+        CPPUNIT_ASSERT( back[2].arrival_ns == 1ull << 40 && back[2].duration_ns == 129 );
+        CPPUNIT_ASSERT( back[2].priority == Priority::Critical && back[0].priority == Priority::Normal );
+        std::stringstream bad("ASTPTT01\x05");
+        CPPUNIT_ASSERT( !task_trace_read(bad, back) );
+
+        ThreadPool tr(2);
+        #if TP_ENABLE_TRACING
+        tr.enable_tracing();
+        for (int i = 0; i < 10; i++) tr.push(Priority::High, [](){});
+        auto g = tr.dg_open();
+        for (int i = 0; i < 5; i++) tr.dg_insert(g, [](){});
+        tr.dg_close(g);
+        tr.wait();
+        tr.disable_tracing();
+        jobs = tr.task_trace();
+        CPPUNIT_ASSERT( jobs.size() == 15 && jobs.front().arrival_ns == 0 );
+        int high = 0, grouped = 0;
+        for (auto &j : jobs) {
+            high += j.priority == Priority::High;
+            grouped += j.group != 0 && j.group == jobs.back().group;
+        }
+        CPPUNIT_ASSERT( high == 10 && grouped == 5 );
+        #else
+        CPPUNIT_ASSERT( tr.task_trace().empty() );
+        #endif
+    }
+
+    void
+    testTimers() {
+        ThreadPool tm(2);
+        typedef std::chrono::steady_clock clock;
+        auto t0 = clock::now();
+        std::atomic<int> early(0), once(0), every(0);
+        tm.push_after(std::chrono::milliseconds(20), [&]() { 
+            if (clock::now() < t0 + std::chrono::milliseconds(20)) ++early; 
+            ++once; 
+        });
+        tm.push_at(std::chrono::system_clock::now() + std::chrono::milliseconds(5), [&once]() { ++once; });
+        auto cancelled = tm.push_after(std::chrono::milliseconds(30), [&once]() { once += 100; });
+        CPPUNIT_ASSERT( cancelled != 0 && tm.cancel_timer(cancelled) && !tm.cancel_timer(cancelled) );
+        auto periodic = tm.push_every(std::chrono::milliseconds(2), [&every]() { ++every; });
+        for (int i = 0; i < 2000 && (once < 2 || every < 3); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CPPUNIT_ASSERT( tm.cancel_timer(periodic) );
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        tm.wait();
+        int runs = every;
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        tm.wait();
+        CPPUNIT_ASSERT( once == 2 && early == 0 && runs >= 3 && every == runs );
+        CPPUNIT_ASSERT( tm.timers_pending() == 0 );
+
+        std::atomic<int> fired(0);
+        std::vector<TimerId> ids;
+        for (int i = 0; i < 100000; i++) {
+            ids.push_back(tm.push_after(std::chrono::microseconds(50000 + (i * 7919) % 20000), 
+                [&fired]() { ++fired; }));
+        }
+        tm.push_after(std::chrono::hours(24 * 365 * 5), [&fired]() { ++fired; });
+        int removed = 0;
+        for (size_t i = 0; i < ids.size(); i += 2) removed += tm.cancel_timer(ids[i]);
+        for (int i = 0; i < 5000 && fired + removed < 100000; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        tm.wait();
+        CPPUNIT_ASSERT( fired + removed == 100000 && tm.timers_pending() == 1 );
+
+        bool thrown = false;
+        try {
+            tm.push_every(std::chrono::milliseconds(0), [](){});
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+    }
+
+    void
+    testCancellation() {
+        ThreadPool cp(1);
+        std::atomic<bool> gate(false);
+        std::atomic<int> c(0);
+        auto block = [&gate]() { while (!gate) std::this_thread::yield(); };
+
+        CancellationToken token;
+        cp.push(block);
+        for (int i = 0; i < 100; i++) cp.push(token, [&c]() { ++c; });
+        cp.push([&c]() { c += 1000; });
+        CPPUNIT_ASSERT( cp.queue_size() == 102 );
+        token.cancel();
+        gate = true;
+        cp.wait();
+        CPPUNIT_ASSERT( c == 1000 && cp.queue_size() == 0 && token.is_cancelled() );
+
+        gate = false;
+        c = 0;
+        std::atomic<bool> barrier(false);
+        cp.push(block);
+        cp.dg_open("request");
+        for (int i = 0; i < 50; i++) cp.dg_insert("request", [&c]() { ++c; });
+        cp.dg_close_with_barrier("request", [&barrier]() { barrier = true; });
+        cp.dg_cancel("request");
+        gate = true;
+        cp.dg_wait("request");
+        cp.wait();
+        CPPUNIT_ASSERT( c == 0 && barrier );
+
+        gate = false;
+        cp.push(block);
+        auto f = cp.future_from_push([]() { return 42; });
+        auto g = cp.future_from_push([]() { return 1; }).then([](int v) { return v + 1; });
+        CPPUNIT_ASSERT( f.cancel() && !f.cancel() && f.is_ready() );
+        CPPUNIT_ASSERT( g.cancel() );
+        gate = true;
+        cp.wait();
+        bool thrown = false;
+        try {
+            f.get();
+        } catch (std::runtime_error &e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+        thrown = false;
+        try {
+            g.get();
+        } catch (std::runtime_error &e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+        auto done = cp.future_from_push([]() { return 7; });
+        done.wait();
+        CPPUNIT_ASSERT( !done.cancel() && done.get() == 7 );
+    }
+
+    void
+    testBackpressure() {
+        ThreadPool bp(1);
+        std::atomic<bool> gate(false), running(false);
+        std::atomic<int> c(0);
+        auto block = [&gate, &running]() { 
+            running = true;
+            while (!gate) std::this_thread::yield(); 
+            running = false;
+        };
+        bp.set_capacity(4);
+        CPPUNIT_ASSERT( bp.capacity() == 4 && bp.overflow_policy() == OverflowPolicy::Block );
+        bp.push(block);
+        for (int i = 0; i < 3; i++) CPPUNIT_ASSERT( bp.try_push([&c]() { ++c; }) );
+        CPPUNIT_ASSERT( !bp.try_push([&c]() { ++c; }) );
+        CPPUNIT_ASSERT( !bp.push_for(std::chrono::milliseconds(5), [&c]() { ++c; }) );
+        std::thread producer([&bp, &c]() {
+            for (int i = 0; i < 20; i++) bp.push([&c]() { ++c; });
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CPPUNIT_ASSERT( bp.queue_size() <= 4 );
+        gate = true;
+        producer.join();
+        CPPUNIT_ASSERT( bp.push_for(std::chrono::seconds(5), [&c]() { ++c; }) );
+        bp.wait();
+        CPPUNIT_ASSERT( c == 24 );
+
+        gate = false;
+        c = 0;
+        bp.set_capacity(3, OverflowPolicy::DropOldest);
+        bp.push(block);
+        while (!running) std::this_thread::yield();
+        bp.push(Priority::High, [&c]() { c += 100; });
+        bp.push([&c]() { c += 10; });
+        bp.push([&c]() { ++c; });
+        bp.push([&c]() { ++c; });
+        gate = true;
+        bp.wait();
+        CPPUNIT_ASSERT( c == 101 && bp.stats().dropped == 2 && bp.stats().capacity == 3 );
+
+        gate = false;
+        c = 0;
+        bp.set_capacity(2, OverflowPolicy::CallerRuns);
+        bp.push(block);
+        bp.push([&c]() { ++c; });
+        auto caller = std::this_thread::get_id();
+        std::thread::id ran;
+        bp.push([&ran]() { ran = std::this_thread::get_id(); });
+        CPPUNIT_ASSERT( ran == caller );
+        gate = true;
+        bp.wait();
+        bp.set_capacity(0);
+        for (int i = 0; i < 10; i++) CPPUNIT_ASSERT( bp.try_push([&c]() { ++c; }) );
+        bp.wait();
+        CPPUNIT_ASSERT( c == 11 );
+
+        /**
+        *   Producers racing try_push for the last
+        *   slot: the losers return false at once,
+        *   whatever the policy.
+        */
+        OverflowPolicy policies[] = { OverflowPolicy::Block, 
+            OverflowPolicy::CallerRuns, OverflowPolicy::DropOldest };
+        for (auto policy : policies) {
+            gate = false;
+            c = 0;
+            bp.set_capacity(2, policy);
+            bp.push(block);
+            while (!running) std::this_thread::yield();
+            std::atomic<int> pushed(0), finished(0);
+            auto racer = [&bp, &c, &pushed, &finished]() {
+                for (int i = 0; i < 1000; i++) {
+                    if (bp.try_push([&c]() { ++c; })) ++pushed;
+                }
+                ++finished;
+            };
+            std::thread r1(racer), r2(racer);
+            auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (finished != 2 && std::chrono::steady_clock::now() < until) {
+                std::this_thread::yield();
+            }
+            CPPUNIT_ASSERT( finished == 2 && pushed == 1 && c == 0 );
+            CPPUNIT_ASSERT( bp.queue_size() == 2 );
+            gate = true;
+            r1.join();
+            r2.join();
+            bp.wait();
+            CPPUNIT_ASSERT( c == 1 );
+        }
+        bp.set_capacity(1);
+        gate = false;
+        bp.push(block);
+        while (!running) std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        CPPUNIT_ASSERT( !bp.push_for(std::chrono::milliseconds(20), [&c]() { ++c; }) );
+        CPPUNIT_ASSERT( std::chrono::steady_clock::now() - start < std::chrono::seconds(2) );
+        gate = true;
+        bp.wait();
+        CPPUNIT_ASSERT( bp.stats().dropped == 2 );
+
+        /**
+        *   The pool's own jobs [graph nodes, 
+        *   coroutine resumptions] are never
+        *   dropped, only the user's.
+        */
+        gate = false;
+        c = 0;
+        bp.set_capacity(3, OverflowPolicy::DropOldest);
+        bp.push(block);
+        while (!running) std::this_thread::yield();
+        bp.push([&c]() { c += 100; });
+        TaskGraph g;
+        std::atomic<int> nodes(0);
+        auto a = g.emplace([&nodes]() { ++nodes; });
+        auto b = g.emplace([&nodes]() { ++nodes; });
+        a.precede(b);
+        bp.submit(g);
+        #if TP_ENABLE_COROUTINES
+        auto hop = bp.spawn(coHop(bp));
+        #endif
+        bp.push([&c]() { ++c; });
+        bp.push(Priority::Low, [&c]() { c += 10; });
+        gate = true;
+        g.wait();
+        #if TP_ENABLE_COROUTINES
+        CPPUNIT_ASSERT( hop.get() == 1 );
+        #endif
+        bp.wait();
+        CPPUNIT_ASSERT( nodes == 2 && c == 10 && bp.stats().dropped == 4 );
+    }
+
+    void
+    testMemory() {
+        ThreadPool mp(1);
+        std::atomic<bool> gate(false);
+        std::atomic<int> c(0);
+        char payload[200] = { 1 };
+        auto round = [&](int n) {
+            gate = false;
+            mp.push([&gate]() { while (!gate) std::this_thread::yield(); });
+            for (int i = 0; i < n; i++) mp.push([&c, payload]() { c += payload[0]; });
+            gate = true;
+            mp.wait();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        };
+        CPPUNIT_ASSERT( mp.memory_reserve() == TP_MEMORY_RESERVE );
+        mp.set_memory_reserve(64 << 20);
+        round(1000);
+        round(1000);
+        size_t warm = mp.stats().memory;
+        CPPUNIT_ASSERT( warm >= 1000 * sizeof(payload) );
+        /**
+        *   The footprint is process wide: the bound
+        *   leaves room for the other threads and 
+        *   for a growth of the queue's map, far 
+        *   below the 5 bursts without reuse.
+        */
+        for (int i = 0; i < 5; i++) round(1000);
+        CPPUNIT_ASSERT( c == 7000 && mp.stats().memory <= warm + 1000 * sizeof(payload) );
+        CPPUNIT_ASSERT( mp.stats().memory_cached >= 500 * sizeof(payload) );
+
+        mp.set_memory_reserve(0);
+        round(1000);
+        CPPUNIT_ASSERT( mp.stats().memory_cached == 0 );
+        CPPUNIT_ASSERT( mp.stats().memory + 500 * sizeof(payload) < warm );
+        mp.trim_memory();
+        CPPUNIT_ASSERT( mp.stats().memory_cached == 0 );
+
+        std::atomic<int> misaligned(0);
+        WideJob wide;
+        wide.misaligned = &misaligned;
+        for (int i = 0; i < 100; i++) mp.push(wide);
+        mp.wait();
+        CPPUNIT_ASSERT( misaligned == 0 );
+
+        ThreadPool rp(1, QueueMode::RingBuffer, 1024);
+        CPPUNIT_ASSERT( rp.stats().memory >= 1024 * sizeof(Task) );
+    }
+
+    void
+    testAutoscale() {
+        bool thrown = false;
+        try {
+            tp->enable_autoscale(AutoscalePolicy(4, 2));
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+        CPPUNIT_ASSERT( !tp->autoscale_enabled() );
+
+        ThreadPool as(1);
+        AutoscalePolicy policy(1, 4, std::chrono::milliseconds(50));
+        policy.interval = std::chrono::milliseconds(2);
+        as.enable_autoscale(policy);
+        CPPUNIT_ASSERT( as.autoscale_enabled() );
+        std::atomic<int> c(0);
+        for (int i = 0; i < 200; i++) {
+            as.push([&c]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ++c;
+            });
+        }
+        int grown = 1;
+        while (c < 200) {
+            grown = std::max(grown, as.pool_size());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        as.wait();
+        CPPUNIT_ASSERT( grown > 1 && grown <= 4 );
+        for (int i = 0; i < 500 && as.pool_size() > 1; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        CPPUNIT_ASSERT( as.pool_size() == 1 );
+        as.stop();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CPPUNIT_ASSERT( as.pool_size() == 0 );
+        as.awake();
+        as.disable_autoscale();
+        CPPUNIT_ASSERT( as.pool_size() == 1 );
+    }
+
     void 
     testDispatchGroupOpen() {
         try {
@@ -203,12 +925,29 @@ public:
             int a = 0;
             tp->dg_wait("t1", [&a](){ a = 30; });  
             CPPUNIT_ASSERT( a == 30);
+            tp->wait();
             CPPUNIT_ASSERT( tp->queue_size() == 0); 
         } catch (std::runtime_error e) {
             CPPUNIT_ASSERT( false ); 
         }
     }
 
+    void 
+    testDispatchGroupMoveOnly() {
+        try {
+            std::unique_ptr<int> p(new int(random(1, 1000)));
+            int expected = *p;
+            std::atomic<int> v(0);
+            tp->dg_open("t1");
+            tp->dg_insert("t1", MoveOnlyJob(std::move(p), &v));
+            tp->dg_close("t1");
+            tp->dg_wait("t1");
+            CPPUNIT_ASSERT( v == expected );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
     void 
     testDispatchGroupNow() {
         try {
@@ -235,6 +974,430 @@ public:
         }
     }
 
+    void 
+    testDispatchGroupHandle() {
+        try {
+            std::atomic<int> a(0);
+            int r = random(1, 100);
+            auto g = tp->dg_open();
+            for (int i = 0; i < r; ++i) {
+                tp->dg_insert(g, [&a](){ ++a; });
+            }
+            CPPUNIT_ASSERT( g->jobs_count() == r );
+            tp->dg_close_with_barrier(g, [&a](){ a += 1000; });
+            tp->dg_wait(g);
+            CPPUNIT_ASSERT( g->has_finished() );
+            CPPUNIT_ASSERT( a == r + 1000 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testDispatchGroupManyShortLived() {
+        try {
+            std::atomic<int> a(0);
+            for (int i = 0; i < 2000; ++i) {
+                auto g = tp->dg_open();
+                tp->dg_insert(g, [&a](){ ++a; });
+                tp->dg_insert(g, [&a](){ ++a; });
+                tp->dg_close(g);
+                tp->dg_wait(g);
+            }
+            CPPUNIT_ASSERT( a == 4000 );
+            tp->wait();
+            CPPUNIT_ASSERT( tp->queue_size() == 0 ); 
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testDispatchGroupJobThrow() {
+        try {
+            auto g = tp->dg_open();
+            tp->dg_insert(g, [](){ throw std::runtime_error("job"); });
+            tp->dg_insert(g, [](){});
+            tp->dg_close(g);
+            tp->dg_wait(g);
+            CPPUNIT_ASSERT( g->has_finished() );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelFor() {
+        try {
+            const int n = 100000;
+            std::vector<int> v(n, 0);
+            Partitioner parts[] = { Partitioner::Static, Partitioner::Dynamic,
+                Partitioner::Guided, Partitioner::Auto };
+            for (auto p : parts) {
+                tp->parallel_for(0, n, 64, [&v](int i) { v[i] += i % 7; }, p);
+            }
+            for (int i = 0; i < n; ++i) {
+                CPPUNIT_ASSERT( v[i] == 4 * (i % 7) );
+            }
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelForRange() {
+        try {
+            std::vector<int> v(random(1, 100000), 1);
+            std::atomic<long> sum(0);
+            std::atomic<int> chunks(0);
+            tp->parallel_for(v.begin(), v.end(), 
+                [&sum, &chunks](std::vector<int>::iterator b, std::vector<int>::iterator e) {
+                    long s = 0;
+                    for (; b != e; ++b) s += *b;
+                    sum += s;
+                    ++chunks;
+                });
+            CPPUNIT_ASSERT( sum == (long)v.size() );
+            CPPUNIT_ASSERT( chunks <= (int)v.size() );
+            tp->parallel_for(5, 5, [](int) { CPPUNIT_ASSERT( false ); });
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelForThrow() {
+        bool thrown = false;
+        try {
+            tp->parallel_for(0, 1000, 1, [](int i) {
+                if (i == 500) throw std::runtime_error("for");
+            }, Partitioner::Dynamic);
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown );
+    }
+
+    void 
+    testParallelForNested() {
+        try {
+            tp->resize(1);
+            std::atomic<int> a(0);
+            auto f = tp->future_from_push([this, &a]() {
+                tp->parallel_for(0, 1000, 1, [&a](int) { ++a; });
+                return 0;
+            });
+            f.get();
+            CPPUNIT_ASSERT( a == 1000 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelReduce() {
+        try {
+            std::vector<int> v(random(1, 100000));
+            for (size_t i = 0; i < v.size(); ++i) v[i] = random(-100, 100);
+            long expected = 0;
+            for (auto x : v) expected += x;
+            long sum = tp->parallel_reduce(v.begin(), v.end(), 0L, 
+                [](long a, long b) { return a + b; });
+            CPPUNIT_ASSERT( sum == expected );
+            
+            std::string s(random(1, 5000), 'a');
+            for (size_t i = 0; i < s.size(); ++i) s[i] = 'a' + i % 26;
+            std::string r = tp->parallel_transform_reduce(s.begin(), s.end(), 
+                std::string(), [](const std::string& a, const std::string& b) { return a + b; },
+                [](char c) { return std::string(1, c); }, 7);
+            CPPUNIT_ASSERT( r == s );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelTransformReduce() {
+        try {
+            long long n = random(1, 100000);
+            long long sum = tp->parallel_transform_reduce(0LL, n, 0LL, 
+                [](long long a, long long b) { return a + b; },
+                [](long long i) { return i * i; });
+            CPPUNIT_ASSERT( sum == (n - 1) * n * (2 * n - 1) / 6 );
+            int empty = tp->parallel_reduce(3, 3, 42, 
+                [](int a, int b) { return a + b; });
+            CPPUNIT_ASSERT( empty == 42 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelSort() {
+        try {
+            std::vector<int> v(random(1, 300000));
+            for (auto &x : v) x = random(-1000000, 1000000);
+            std::vector<int> expected(v);
+            std::sort(expected.begin(), expected.end());
+            parallel_sort(*tp, v.begin(), v.end());
+            CPPUNIT_ASSERT( v == expected );
+
+            std::reverse(expected.begin(), expected.end());
+            parallel_sort(*tp, v.begin(), v.end(), std::greater<int>());
+            CPPUNIT_ASSERT( v == expected );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testParallelScan() {
+        try {
+            std::vector<long> v(random(1, 300000));
+            for (auto &x : v) x = random(-100, 100);
+            std::vector<long> expected(v.size());
+            std::partial_sum(v.begin(), v.end(), expected.begin());
+            std::vector<long> out(v.size());
+            parallel_inclusive_scan(*tp, v.begin(), v.end(), out.begin());
+            CPPUNIT_ASSERT( out == expected );
+
+            long acc = 10;
+            for (size_t i = 0; i < v.size(); ++i) {
+                expected[i] = acc;
+                acc += v[i];
+            }
+            parallel_exclusive_scan(*tp, v.begin(), v.end(), v.begin(), 10L);
+            CPPUNIT_ASSERT( v == expected );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testPriority() {
+        try {
+            ThreadPool one(1);
+            std::mutex m;
+            std::vector<int> order;
+            std::atomic<bool> go(false);
+            one.push([&go]() { while (!go) std::this_thread::yield(); });
+            auto rec = [&m, &order](int v) { 
+                return [&m, &order, v]() { std::lock_guard<std::mutex> l(m); order.push_back(v); };
+            };
+            one.push(Priority::Low, rec(0));
+            one.push(rec(1));
+            one.push(Priority::High, rec(2));
+            one.push(Priority::Critical, rec(3));
+            auto f = one.future_from_push(Priority::High, []() { return 7; });
+            go = true;
+            one.wait();
+            CPPUNIT_ASSERT( f.get() == 7 );
+            CPPUNIT_ASSERT( order.size() == 4 );
+            CPPUNIT_ASSERT( order[0] == 3 && order[1] == 2 );
+            CPPUNIT_ASSERT( order[2] == 1 && order[3] == 0 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testPriorityAging() {
+        try {
+            ThreadPool one(1);
+            std::atomic<int> high_done(0);
+            std::atomic<int> low_at(-1);
+            std::atomic<bool> go(false);
+            one.push([&go]() { while (!go) std::this_thread::yield(); });
+            one.push(Priority::Low, [&high_done, &low_at]() { low_at = high_done.load(); });
+            for (int i = 0; i < 10 * TP_PRIORITY_AGING; ++i) {
+                one.push(Priority::High, [&high_done]() { ++high_done; });
+            }
+            go = true;
+            one.wait();
+            CPPUNIT_ASSERT( low_at >= 0 );
+            CPPUNIT_ASSERT( low_at <= TP_PRIORITY_AGING );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testFutureThen() {
+        try {
+            int r = random(1, 1000);
+            std::atomic<int> seen(0);
+            auto f = tp->future_from_push([r]() { return r; })
+                .then([](int v) { return std::to_string(v * 2); })
+                .then([&seen](std::string s) { seen = std::stoi(s); });
+            f.get();
+            CPPUNIT_ASSERT( seen == 2 * r );
+            
+            auto ready = tp->future_from_push([]() {});
+            ready.wait();
+            auto g = ready.then([r]() { return r + 1; });
+            CPPUNIT_ASSERT( g.get() == r + 1 );
+            CPPUNIT_ASSERT( !g.valid() );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testFutureThenThrow() {
+        std::atomic<bool> called(false);
+        auto f = tp->future_from_push([]() -> int { throw std::runtime_error("first"); })
+            .then([&called](int v) { called = true; return v; });
+        bool thrown = false;
+        try {
+            f.get();
+        } catch (std::runtime_error e) {
+            thrown = std::string(e.what()) == "first";
+        }
+        CPPUNIT_ASSERT( thrown );
+        CPPUNIT_ASSERT( !called );
+    }
+
+    void 
+    testTaskGraph() {
+        try {
+            TaskGraph g;
+            std::atomic<int> step(0);
+            std::atomic<int> a_at(-1), b_at(-1), c_at(-1), d_at(-1);
+            auto a = g.emplace([&]() { a_at = step++; });
+            auto b = g.emplace([&]() { b_at = step++; });
+            auto c = g.emplace([&]() { c_at = step++; });
+            auto d = g.emplace([&]() { d_at = step++; });
+            a.precede(b).precede(c);
+            d.succeed(b).succeed(c);
+            for (int run = 0; run < 3; ++run) {
+                step = 0;
+                tp->run(g);
+                CPPUNIT_ASSERT( step == 4 );
+                CPPUNIT_ASSERT( a_at == 0 && d_at == 3 );
+                CPPUNIT_ASSERT( b_at > a_at && c_at > a_at );
+            }
+            tp->submit(g);
+            g.wait();
+            CPPUNIT_ASSERT( step == 8 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testTaskGraphErrors() {
+        TaskGraph g;
+        std::atomic<bool> after(false);
+        auto a = g.emplace([]() { throw std::runtime_error("node"); });
+        auto b = g.emplace([&after]() { after = true; });
+        a.precede(b);
+        bool thrown = false;
+        try {
+            tp->run(g);
+        } catch (std::runtime_error e) {
+            thrown = std::string(e.what()) == "node";
+        }
+        CPPUNIT_ASSERT( thrown );
+        CPPUNIT_ASSERT( !after );
+
+        b.precede(a);
+        thrown = false;
+        try {
+            tp->submit(g);
+        } catch (std::runtime_error e) {
+            thrown = true;
+        }
+        CPPUNIT_ASSERT( thrown == (TP_ENABLE_SANITY_CHECKS != 0) );
+        g.wait();
+    }
+
+    void 
+    testWhenAll() {
+        try {
+            int r = random(1, 100);
+            std::vector<Future<int> > fs;
+            for (int i = 0; i < r; ++i) {
+                fs.push_back(tp->future_from_push([i]() { return i * i; }));
+            }
+            auto all = when_all(std::move(fs));
+            std::vector<int> v = all.get();
+            CPPUNIT_ASSERT( (int)v.size() == r );
+            for (int i = 0; i < r; ++i) CPPUNIT_ASSERT( v[i] == i * i );
+
+            std::atomic<int> c(0);
+            std::vector<Future<void> > vs;
+            for (int i = 0; i < r; ++i) vs.push_back(tp->future_from_push([&c]() { ++c; }));
+            when_all(std::move(vs)).get();
+            CPPUNIT_ASSERT( c == r );
+            CPPUNIT_ASSERT( when_all(std::vector<Future<int> >()).get().empty() );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testWhenAny() {
+        try {
+            std::atomic<bool> go(false);
+            std::atomic<bool> started(false);
+            std::vector<Future<int> > fs;
+            fs.push_back(tp->future_from_push([&go, &started]() { 
+                started = true;
+                while (!go) std::this_thread::yield(); 
+                return 1; 
+            }));
+            while (!started) std::this_thread::yield();
+            fs.push_back(tp->future_from_push([]() { return 2; }));
+            auto any = when_any(std::move(fs));
+            auto first = any.get();
+            go = true;
+            CPPUNIT_ASSERT( first.first == 1 && first.second == 2 );
+            tp->wait();
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testFutureGetHelps() {
+        try {
+            tp->stop();
+            auto f = tp->future_from_push([]() { return 5; });
+            auto g = f.then([](int v) { return v + 1; });
+            CPPUNIT_ASSERT( g.get() == 6 );
+            CPPUNIT_ASSERT( tp->queue_size() == 0 );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    #if TP_ENABLE_COROUTINES
+    void 
+    testCoroutines() {
+        try {
+            int r = random(1, 1000);
+            std::atomic<bool> on_pool(false);
+            auto f = tp->spawn(coChain(*tp, r, std::this_thread::get_id(), &on_pool));
+            f.wait();
+            CPPUNIT_ASSERT( f.get() == 2 * r + 1 );
+            CPPUNIT_ASSERT( on_pool );
+        } catch (std::runtime_error e) {
+            CPPUNIT_ASSERT( false ); 
+        }
+    }
+
+    void 
+    testCoroutineThrow() {
+        bool thrown = false;
+        try {
+            tp->spawn(coThrow(*tp)).get();
+        } catch (std::runtime_error e) {
+            thrown = std::string(e.what()) == "coroutine";
+        }
+        CPPUNIT_ASSERT( thrown );
+    }
+    #endif
+
     /*void
     testSetExcHandl() {
         std::string err;
@@ -258,13 +1421,36 @@ private:
     CPPUNIT_TEST(testResize);
     CPPUNIT_TEST(testStop);
     CPPUNIT_TEST(testAwake);
+    CPPUNIT_TEST(testRetire);
     CPPUNIT_TEST(testPush);
     CPPUNIT_TEST(testVariadicPush);
     CPPUNIT_TEST(testPushOperator);
+    CPPUNIT_TEST(testPushBulk);
+    CPPUNIT_TEST(testPushBulkStopped);
+    CPPUNIT_TEST(testCpulist);
+    CPPUNIT_TEST(testAffinity);
     CPPUNIT_TEST(testApplyFor);
     CPPUNIT_TEST(testApplyForAsync);
     CPPUNIT_TEST(testFuture);
+    CPPUNIT_TEST(testTask);
+    CPPUNIT_TEST(testPushMoveOnly);
+    CPPUNIT_TEST(testFutureMoveOnly);
+    CPPUNIT_TEST(testWorkStealing);
+    CPPUNIT_TEST(testWorkStealingResize);
+    CPPUNIT_TEST(testRingBuffer);
+    CPPUNIT_TEST(testRingBufferOverflow);
+    CPPUNIT_TEST(testWaitDoesNotPoll);
+    CPPUNIT_TEST(testApplyForThrow);
     CPPUNIT_TEST(testSleepTime);
+    CPPUNIT_TEST(testSpinBudget);
+    CPPUNIT_TEST(testStats);
+    CPPUNIT_TEST(testTracing);
+    CPPUNIT_TEST(testTaskTrace);
+    CPPUNIT_TEST(testTimers);
+    CPPUNIT_TEST(testCancellation);
+    CPPUNIT_TEST(testBackpressure);
+    CPPUNIT_TEST(testMemory);
+    CPPUNIT_TEST(testAutoscale);
     CPPUNIT_TEST(testDispatchGroupOpen);
     CPPUNIT_TEST(testDispatchGroupClose);
     CPPUNIT_TEST(testDispatchGroupInsert);
@@ -272,13 +1458,109 @@ private:
     CPPUNIT_TEST(testDispatchGroupWrongClose);
     CPPUNIT_TEST(testDispatchGroupWrongInsert);
     CPPUNIT_TEST(testDispatchGroupWaitAndFire);
+    CPPUNIT_TEST(testDispatchGroupMoveOnly);
     CPPUNIT_TEST(testDispatchGroupNow);
     CPPUNIT_TEST(testDispatchGroupCloseBarrier);
+    CPPUNIT_TEST(testDispatchGroupHandle);
+    CPPUNIT_TEST(testDispatchGroupManyShortLived);
+    CPPUNIT_TEST(testDispatchGroupJobThrow);
+    CPPUNIT_TEST(testParallelFor);
+    CPPUNIT_TEST(testParallelForRange);
+    CPPUNIT_TEST(testParallelForThrow);
+    CPPUNIT_TEST(testParallelForNested);
+    CPPUNIT_TEST(testParallelReduce);
+    CPPUNIT_TEST(testParallelTransformReduce);
+    CPPUNIT_TEST(testParallelSort);
+    CPPUNIT_TEST(testParallelScan);
+    CPPUNIT_TEST(testPriority);
+    CPPUNIT_TEST(testPriorityAging);
+    CPPUNIT_TEST(testFutureThen);
+    CPPUNIT_TEST(testFutureThenThrow);
+    CPPUNIT_TEST(testTaskGraph);
+    CPPUNIT_TEST(testTaskGraphErrors);
+    CPPUNIT_TEST(testWhenAll);
+    CPPUNIT_TEST(testWhenAny);
+    CPPUNIT_TEST(testFutureGetHelps);
+    #if TP_ENABLE_COROUTINES
+    CPPUNIT_TEST(testCoroutines);
+    CPPUNIT_TEST(testCoroutineThrow);
+    #endif
     //CPPUNIT_TEST(testSetExcHandl);
     CPPUNIT_TEST_SUITE_END();
 
     ThreadPool *tp;
 
+    /**
+    *   Callable aligned beyond max_align_t,
+    *   too large to be stored inline.
+    */
+    struct alignas(64) WideJob
+    {
+        void
+        operator()() {
+            if (reinterpret_cast<std::uintptr_t>(this) % 64 != 0) ++*misaligned;
+        }
+
+        char pad[64];
+        std::atomic<int> *misaligned;
+    };
+
+    /**
+    *   Callable that cannot be copied.
+    */
+    struct MoveOnlyJob
+    {
+        MoveOnlyJob(std::unique_ptr<int> p, std::atomic<int> *o) : 
+            value(std::move(p)), out(o) {};
+
+        int 
+        operator()() {
+            if (out) *out = *value;
+            return *value;
+        }
+
+        std::unique_ptr<int> value;
+        std::atomic<int> *out;
+    };
+
+    #if TP_ENABLE_COROUTINES
+    /**
+    *   Coroutines used by the tests: hop on the
+    *   pool, await a future, a task and a group.
+    */
+    static task<int> 
+    coDouble(ThreadPool &pool, int v, std::thread::id caller, std::atomic<bool> *on_pool) {
+        co_await pool.schedule();
+        *on_pool = std::this_thread::get_id() != caller;
+        int w = co_await pool.future_from_push([v]() { return v * 2; });
+        co_return w;
+    }
+
+    static task<int> 
+    coChain(ThreadPool &pool, int v, std::thread::id caller, std::atomic<bool> *on_pool) {
+        int a = co_await coDouble(pool, v, caller, on_pool);
+        std::atomic<int> done(0);
+        auto g = pool.dg_open();
+        pool.dg_insert(g, [&done]() { ++done; });
+        pool.dg_insert(g, [&done]() { ++done; });
+        pool.dg_close(g);
+        co_await pool.dg_wait_async(g);
+        co_return a + done - 1;
+    }
+
+    static task<int> 
+    coHop(ThreadPool &pool) {
+        co_await pool.schedule();
+        co_return 1;
+    }
+
+    static task<> 
+    coThrow(ThreadPool &pool) {
+        co_await pool.schedule();
+        throw std::runtime_error("coroutine");
+    }
+    #endif
+
     int
     random(int min, int max) {
         return rand() % max + min;
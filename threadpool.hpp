@@ -51,9 +51,18 @@
 #include <map>
 #include <string>
 #include <deque>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <limits>
 #include <assert.h>
 #include <exception>
 #include <stdexcept>
+#include <fstream>
+#include <chrono>
 #ifdef DEBUG
 #include <iostream>
 #endif
@@ -66,6 +75,135 @@
 #define TP_ENABLE_SANITY_CHECKS 1
 #endif
 
+#ifndef TP_ENABLE_LEGACY_SLEEP_WAIT
+#define TP_ENABLE_LEGACY_SLEEP_WAIT 0
+#endif
+
+#ifndef TP_CACHE_LINE_SIZE
+#define TP_CACHE_LINE_SIZE 64
+#endif
+
+#ifndef TP_TASK_INLINE_SIZE
+#define TP_TASK_INLINE_SIZE 48
+#endif
+
+#ifndef TP_PRIORITY_AGING
+#define TP_PRIORITY_AGING 32
+#endif
+
+/**
+*   Free blocks each thread keeps for each size
+*   class of the node allocator [see NodePool].
+*/
+#ifndef TP_FREE_LIST_SIZE
+#define TP_FREE_LIST_SIZE 256
+#endif
+
+/**
+*   Default bytes of free nodes kept when the
+*   pools go idle [see set_memory_reserve].
+*/
+#ifndef TP_MEMORY_RESERVE
+#define TP_MEMORY_RESERVE (1u << 20)
+#endif
+
+/**
+*   Default number of pause iterations an idle 
+*   thread spins looking for work before it
+*   sleeps [see set_spin_budget].
+*/
+#ifndef TP_SPIN_BUDGET
+#define TP_SPIN_BUDGET 1024
+#endif
+
+/**
+*   Per-thread counters and latency histograms
+*   [see ThreadPool::stats()]. When disabled the
+*   instrumentation compiles out entirely and
+*   stats() reports only the executed jobs.
+*/
+#ifndef TP_ENABLE_METRICS
+#define TP_ENABLE_METRICS 0
+#endif
+
+/**
+*   Number of log2 buckets of the histograms,
+*   the last one collects everything above
+*   2^(TP_METRICS_BUCKETS - 1) ns.
+*/
+#ifndef TP_METRICS_BUCKETS
+#define TP_METRICS_BUCKETS 40
+#endif
+
+/**
+*   Timeline of the pool threads [jobs, steals,
+*   parks, dispatch groups] exported as Chrome
+*   trace JSON [see ThreadPool::enable_tracing()].
+*   When disabled the probes compile out.
+*/
+#ifndef TP_ENABLE_TRACING
+#define TP_ENABLE_TRACING 0
+#endif
+
+/**
+*   Events kept for each thread, a power of two:
+*   the oldest are overwritten.
+*/
+#ifndef TP_TRACE_BUFFER_SIZE
+#define TP_TRACE_BUFFER_SIZE 4096
+#endif
+
+/**
+*   Resolution of the timers [push_after, 
+*   push_at, push_every] in microseconds: a
+*   timer fires on the first tick at or after
+*   its deadline.
+*/
+#ifndef TP_TIMER_TICK_US
+#define TP_TIMER_TICK_US 1000
+#endif
+
+/**
+*   Coroutine support [schedule, task<T>,
+*   co_await on futures and groups] is built
+*   only when the compiler supports C++20
+*   coroutines, e.g. with -std=c++20.
+*/
+#ifndef TP_ENABLE_COROUTINES
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define TP_ENABLE_COROUTINES 1
+#endif
+#endif
+#endif
+
+#ifndef TP_ENABLE_COROUTINES
+#define TP_ENABLE_COROUTINES 0
+#endif
+
+#if TP_ENABLE_COROUTINES
+#include <coroutine>
+#include <optional>
+#endif
+
+/**
+*   Thread pinning [set_affinity] uses 
+*   pthread_setaffinity_np, available on Linux;
+*   elsewhere set_affinity returns false.
+*/
+#ifndef TP_ENABLE_AFFINITY
+#if defined(__linux__)
+#define TP_ENABLE_AFFINITY 1
+#else
+#define TP_ENABLE_AFFINITY 0
+#endif
+#endif
+
+#if TP_ENABLE_AFFINITY
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 
 namespace astp 
 {    
@@ -75,1071 +213,6958 @@ namespace astp
     }
 
     /**
-    *   Structure of the class:
-    *
-    *   private:
-    *       - Nested Semaphore class
-    *       - Nested DispatchGroup class
-    *       - Nested ThreadsBlocker class
-    *
-    *   public:
-    *       - API
+    *   Hint to the cpu that the calling thread
+    *   is spinning [pause, yield on ARM].
+    */
+    inline void
+    cpu_relax() {
+        #if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+        #elif defined(_M_IX86) || defined(_M_X64)
+        _mm_pause();
+        #elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+        #endif
+    }
+
+    /**
+    *   True for the callables with a const
+    *   cancelled() method: the pool drops them
+    *   without running when it returns true
+    *   [see CancellationToken].
+    */
+    template<class Fn, class = void> struct IsCancellable : std::false_type {};
+
+    template<class Fn> struct IsCancellable<Fn, 
+        decltype(void(std::declval<const Fn&>().cancelled()))> : std::true_type {};
+
+    /**
+    *   Size class allocator of the pool nodes:
+    *   queue chunks, closures too large to live 
+    *   inline in a Task, work stealing nodes and
+    *   future states. Blocks of 32 to 1024 bytes
+    *   are recycled, larger ones go to the system.
     *
-    *   private:
-    *       - All the class variables and
-    *         methods
-    *   
-    *   Enjoy!
+    *   Each thread keeps up to TP_FREE_LIST_SIZE
+    *   free blocks per class and exchanges them 
+    *   in batches with a process wide depot, so
+    *   the blocks freed by the workers come back 
+    *   to the producers: in the steady state a 
+    *   push and a pop do no global allocation.
+    *   trim() gives the depot back to the system
+    *   down to a reserve [see set_memory_reserve].
     */
-    class ThreadPool
+    class NodePool
     {
-    private:
-        /**
-        *    ____                             _                    
-        *   / ___|  ___ _ __ ___   __ _ _ __ | |__   ___  _ __ ___ 
-        *   \___ \ / _ \ '_ ` _ \ / _` | '_ \| '_ \ / _ \| '__/ _ \
-        *    ___) |  __/ | | | | | (_| | |_) | | | | (_) | | |  __/
-        *   |____/ \___|_| |_| |_|\__,_| .__/|_| |_|\___/|_|  \___|
-        *                              |_|                         
-        *
-        *
-        *   Nested ThreadPool class 
-        *   that represents a semaphore
-        *   in order to make the ThreadPool thread safe.
-        */
-        class Semaphore
-        {
-        public:
-            Semaphore(int value) : _value(value) {};
-            Semaphore(const Semaphore &S) : _mutex(), _cv() {};
-            Semaphore& operator=(Semaphore S) {return *this;}
-            ~Semaphore() {};
-    
-            void
-            wait() {
-                std::unique_lock<std::mutex> lock(_mutex);
-                --_value;
-                if (_value < 0) {
-                    do {
-                        _cv.wait(lock);
-                    } while (_wake_ups < 1);
-                    --_wake_ups;
-                }
+    public:
+        static const size_t classes = 6;
+        static const size_t max_block = 32u << (classes - 1);
+
+        static void*
+        allocate(size_t bytes) {
+            if (bytes > max_block) {
+                void *p = ::operator new(bytes);
+                _large().fetch_add(bytes, std::memory_order_relaxed);
+                return p;
             }
- 
-            void 
-            signal() {
-                std::unique_lock<std::mutex> lock(_mutex);
-                ++_value;
-                if (_value <= 0) {
-                    ++_wake_ups;
-                    _cv.notify_one();
-                }
+            const size_t c = _class(bytes);
+            FreeList &l = _cache().lists[c];
+            if (!l.head) _refill(c, l);
+            if (!l.head) {
+                void *p = ::operator new(_size(c));
+                _reserved().fetch_add(_size(c), std::memory_order_relaxed);
+                return p;
             }
-    
-        private:
-            int _value;
-            int _wake_ups = 0;
-            std::mutex _mutex;
-            std::condition_variable _cv;
-        };
+            Block *b = l.head;
+            l.head = b->next;
+            --l.count;
+            return b;
+        }
+
+        static void
+        deallocate(void *p, size_t bytes) noexcept {
+            if (bytes > max_block) {
+                _large().fetch_sub(bytes, std::memory_order_relaxed);
+                ::operator delete(p);
+                return;
+            }
+            const size_t c = _class(bytes);
+            FreeList &l = _cache().lists[c];
+            if (l.count >= TP_FREE_LIST_SIZE) _spill(c, l, (l.count + 1) / 2);
+            Block *b = static_cast<Block*>(p);
+            b->next = l.head;
+            l.head = b;
+            ++l.count;
+        }
 
         /**
-        *    ____  _                 _       _      ____                       
-        *   |  _ \(_)___ _ __   __ _| |_ ___| |__  / ___|_ __ ___  _   _ _ __  
-        *   | | | | / __| '_ \ / _` | __/ __| '_ \| |  _| '__/ _ \| | | | '_ \ 
-        *   | |_| | \__ \ |_) | (_| | || (__| | | | |_| | | | (_) | |_| | |_) |
-        *   |____/|_|___/ .__/ \__,_|\__\___|_| |_|\____|_|  \___/ \__,_| .__/ 
-        *               |_|                                             |_|    
-        *   
-        *
-        *   Nested ThreadPool class 
-        *   that stores informations
-        *   about dispatch groups.
+        *   Blocks aligned to more than max_align_t
+        *   skip the size classes and go to the 
+        *   system, as the large ones.
         */
-        class DispatchGroup
-        {
-        public:
-            DispatchGroup(std::string id) : 
-                _id(id), 
-                _closed(false),
-                _has_finished(false),
-                _jobs_done_counter(0),
-                _jobs_count_at_leave(0), 
-                _sem_sync(Semaphore(1)) {};
-            DispatchGroup(DispatchGroup&& DP) noexcept :
-                _id(DP.id()), 
-                _closed(DP.is_leave()),
-                _has_finished(DP.has_finished()),
-                _jobs_done_counter(0),
-                _jobs_count_at_leave(0),
-                _sem_sync(Semaphore(1)) {};
-            DispatchGroup& operator = (DispatchGroup&& DP) = default;
-            DispatchGroup(const DispatchGroup& DP) = delete;
-            DispatchGroup& operator = (const DispatchGroup& DP) = delete;
-
-            ~DispatchGroup() {};
+        static void*
+        allocate(size_t bytes, size_t align) {
+            if (align <= alignof(std::max_align_t)) return allocate(bytes);
+            #if defined(__cpp_aligned_new)
+            void *p = ::operator new(bytes, std::align_val_t(align));
+            #else
+            /**
+            *   The raw block is stored just before
+            *   the aligned one.
+            */
+            char *raw = static_cast<char*>(::operator new(bytes + align));
+            void *p = reinterpret_cast<void*>((reinterpret_cast<std::uintptr_t>(raw) + 
+                align) & ~static_cast<std::uintptr_t>(align - 1));
+            static_cast<void**>(p)[-1] = raw;
+            #endif
+            _large().fetch_add(bytes, std::memory_order_relaxed);
+            return p;
+        }
 
-            void 
-            leave()  {
-                _closed = true;
-                _jobs_count_at_leave = _jobs.size();
-                _check_end_condition();
+        static void
+        deallocate(void *p, size_t bytes, size_t align) noexcept {
+            if (align <= alignof(std::max_align_t)) {
+                deallocate(p, bytes);
+                return;
             }
+            _large().fetch_sub(bytes, std::memory_order_relaxed);
+            #if defined(__cpp_aligned_new)
+            ::operator delete(p, std::align_val_t(align));
+            #else
+            ::operator delete(static_cast<void**>(p)[-1]);
+            #endif
+        }
 
-            template<class T> void 
-            leave(T&& t)  {
-                leave();
-                _end_action = t;
+        /**
+        *   Moves the free blocks of the calling 
+        *   thread to the depot, where trim() and
+        *   the other threads can reach them.
+        */
+        static void
+        flush() noexcept {
+            Cache &cache = _cache();
+            for (size_t c = 0; c < classes; ++c) {
+                _spill(c, cache.lists[c], cache.lists[c].count);
             }
+        }
 
-            bool
-            is_leave() const { 
-                return _closed; 
+        /**
+        *   Frees the blocks of the depot above
+        *   reserve bytes, split evenly among the 
+        *   size classes.
+        */
+        static void
+        trim(size_t reserve) noexcept {
+            const size_t share = reserve / classes;
+            for (size_t c = 0; c < classes; ++c) {
+                Depot &d = _depot(c);
+                Block *drop = nullptr;
+                size_t n = 0;
+                {
+                    std::lock_guard<std::mutex> lock(d.mutex);
+                    while (d.head && d.count * _size(c) > share) {
+                        Block *b = d.head;
+                        d.head = b->next;
+                        --d.count;
+                        b->next = drop;
+                        drop = b;
+                        ++n;
+                    }
+                    _cached().fetch_sub(n * _size(c), std::memory_order_relaxed);
+                }
+                while (drop) {
+                    Block *b = drop;
+                    drop = b->next;
+                    ::operator delete(b);
+                }
+                _reserved().fetch_sub(n * _size(c), std::memory_order_relaxed);
             }
+        }
 
-            template<class F> void
-            insert(const F &f)  {
-                if (_closed) return;
-                auto func = [=] () { f(); _signal_end_of_job(); };
-                _jobs.push_back(func);
-            }
+        /**
+        *   Bytes taken from the system: the small 
+        *   blocks in use or free, the large blocks
+        *   in use.
+        */
+        static size_t
+        footprint() noexcept {
+            return _reserved().load(std::memory_order_relaxed) + 
+                _large().load(std::memory_order_relaxed);
+        }
 
-            std::vector<std::function<void()> > 
-            jobs()  { return _jobs; }
+        /**
+        *   Bytes of the free blocks in the depot.
+        */
+        static size_t
+        cached() noexcept {
+            return _cached().load(std::memory_order_relaxed);
+        }
 
-            bool
-            has_finished() const {
-                return _has_finished;
-            }
+    private:
+        struct Block 
+        { 
+            Block *next; 
+        };
 
-            std::string
-            id() const { 
-                return _id; 
-            }
+        struct FreeList
+        {
+            FreeList() : head(nullptr), count(0) {};
 
-            int
-            jobs_count() const { 
-                return _jobs.size(); 
-            }
+            Block *head;
+            size_t count;
+        };
 
-            void
-            synchronize() {
-                _sem_sync.wait();
+        struct Cache
+        {
+            ~Cache() { 
+                for (size_t c = 0; c < classes; ++c) _spill(c, lists[c], lists[c].count);
             }
 
-            void
-            end_synchronize() {
-                _sem_sync.signal();
-            }
-            
-        private:
-            std::string _id;
-            std::function<void()> _end_action;
-            std::vector<std::function<void()> > _jobs;
-            std::atomic<bool> _closed;
-            std::atomic<bool> _has_finished;
-            std::atomic<int> _jobs_done_counter;
-            std::atomic<int> _jobs_count_at_leave;
-            Semaphore _sem_sync;
+            FreeList lists[classes];
+        };
 
-            void
-            _signal_end_of_job() { 
-                _jobs_done_counter++; 
-                _check_end_condition();
-            }
+        struct Depot
+        {
+            Depot() : head(nullptr), count(0) {};
 
-            void
-            _check_end_condition() {
-                if (_jobs_done_counter == _jobs_count_at_leave && _closed) {
-                    _has_finished = true;
-                    if (_end_action) _end_action();
-                }
-            }
+            std::mutex mutex;
+            Block *head;
+            size_t count;
         };
 
+        static size_t
+        _size(size_t c) noexcept {
+            return size_t(32) << c;
+        }
+
+        static size_t
+        _class(size_t bytes) noexcept {
+            size_t c = 0;
+            while (_size(c) < bytes) ++c;
+            return c;
+        }
+
         /**
-        *   Thread safe class that manage
-        *   the waiting of the pool threads
-        *   when the queue is empty.
+        *   Moves n blocks of the list to the depot.
         */
-        class ThreadsBlocker
-        {
-        public:
-            ThreadsBlocker() : _sem_interface(Semaphore(1)) {};
-            ~ThreadsBlocker() {};
+        static void
+        _spill(size_t c, FreeList &l, size_t n) noexcept {
+            if (!n) return;
+            Block *first = l.head, *last = first;
+            for (size_t i = 1; i < n; ++i) last = last->next;
+            l.head = last->next;
+            l.count -= n;
+            Depot &d = _depot(c);
+            std::lock_guard<std::mutex> lock(d.mutex);
+            last->next = d.head;
+            d.head = first;
+            d.count += n;
+            _cached().fetch_add(n * _size(c), std::memory_order_relaxed);
+        }
 
-            void
-            activate_barrier() {
-                _sem_interface.wait();
-                _barrier = true;
-                _sem_interface.signal();
+        /**
+        *   Takes half a cache of blocks from the depot.
+        */
+        static void
+        _refill(size_t c, FreeList &l) noexcept {
+            Depot &d = _depot(c);
+            std::lock_guard<std::mutex> lock(d.mutex);
+            size_t n = 0;
+            while (d.head && n < (TP_FREE_LIST_SIZE + 1) / 2) {
+                Block *b = d.head;
+                d.head = b->next;
+                b->next = l.head;
+                l.head = b;
+                ++n;
             }
+            d.count -= n;
+            l.count += n;
+            _cached().fetch_sub(n * _size(c), std::memory_order_relaxed);
+        }
 
-            void
-            deactivate_barrier() {
-                _sem_interface.wait();
-                _barrier = false;
-                _sem_interface.signal();
-            }
+        static Cache&
+        _cache() {
+            static thread_local Cache cache;
+            return cache;
+        }
 
-            bool
-            thread_wait(Semaphore *rsem) {
-                _sem_interface.wait();
-                if (_barrier) { 
-                    _sem_interface.signal();
-                    return false;
-                }
-                _sems.push_back(rsem);
-                _sem_interface.signal();
-                return true;
-            }
+        /**
+        *   The depots are never destroyed: the
+        *   caches of the threads that outlive the
+        *   statics are flushed into them at exit.
+        */
+        static Depot&
+        _depot(size_t c) noexcept {
+            static Depot *depots = new Depot[classes];
+            return depots[c];
+        }
 
-            void
-            unblock(bool also_activate_barrier = false) {
-                _sem_interface.wait();
-                if (also_activate_barrier) {
-                    _barrier = true;
-                }
-                for (auto &s : _sems) {
-                    s->signal();
-                }
-                _sems.clear();
-                _sem_interface.signal();
-            }
+        static std::atomic<size_t>&
+        _reserved() noexcept {
+            static std::atomic<size_t> *bytes = new std::atomic<size_t>(0);
+            return *bytes;
+        }
 
-        private:
-            std::vector<Semaphore*> _sems;
-            bool _barrier = false;
-            Semaphore _sem_interface;
-        };
+        static std::atomic<size_t>&
+        _large() noexcept {
+            static std::atomic<size_t> *bytes = new std::atomic<size_t>(0);
+            return *bytes;
+        }
 
-        /**
-        *       _    ____ ___ 
-        *      / \  |  _ \_ _|
-        *     / _ \ | |_) | | 
-        *    / ___ \|  __/| | 
-        *   /_/   \_\_|  |___|
-        *
-        */
-    public:
-        /**
-        *   If *max_threads* is not specified,
-        *   the pool size is set to the max number
-        *   of threads supported by the architecture.
-        *   At least one thread is created.
-        */
-        ThreadPool(int max_threads = std::thread::hardware_concurrency()) 
-        noexcept(false) : 
-            _sem_api(Semaphore(1)),
-            _sem_job_ins_container(Semaphore(1)),
-            _thread_sleep_time_ns(1000),
-            _run_pool_thread(true),
-            _threads_count(0),
-            _thread_to_kill_c(0),
-            _push_c(0),
-            _prev_threads(0)
-        {
-            #if TP_ENABLE_DEFAULT_EXCEPTION_CALL
-            _exception_action = [](std::exception_ptr e) {};
-            #endif
+        static std::atomic<size_t>&
+        _cached() noexcept {
+            static std::atomic<size_t> *bytes = new std::atomic<size_t>(0);
+            return *bytes;
+        }
+    };
 
-            #if TP_ENABLE_SANITY_CHECKS
-            try {
-                resize(max_threads);
-            } catch(std::runtime_error e) {
-                throw e;
+    /**
+    *   Allocator on top of NodePool, for the 
+    *   containers of the pool and the shared 
+    *   states of the futures.
+    */
+    template<class T> class PoolAllocator
+    {
+    public:
+        typedef T value_type;
+
+        PoolAllocator() noexcept {};
+        template<class U> PoolAllocator(const PoolAllocator<U>&) noexcept {};
+
+        T*
+        allocate(size_t n) {
+            return static_cast<T*>(NodePool::allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void
+        deallocate(T *p, size_t n) noexcept {
+            NodePool::deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        template<class U> bool
+        operator==(const PoolAllocator<U>&) const { return true; }
+
+        template<class U> bool
+        operator!=(const PoolAllocator<U>&) const { return false; }
+    };
+
+    /**
+    *    _____         _    
+    *   |_   _|_ _ ___| | __
+    *     | |/ _` / __| |/ /
+    *     | | (_| \__ \   < 
+    *     |_|\__,_|___/_|\_\
+    *
+    *
+    *   Move only, type erased, void() callable:
+    *   the job type stored in the queues.
+    *   Callables up to TP_TASK_INLINE_SIZE bytes 
+    *   that can be moved without throwing live
+    *   inside the Task, so pushing them never
+    *   allocates; bigger ones go on the heap.
+    *   Unlike std::function, the callable does
+    *   not need to be copyable.
+    */
+    class Task
+    {
+    public:
+        Task() noexcept : _vtable(nullptr) {};
+
+        template<class F, class = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, Task>::value>::type> 
+        Task(F&& f) : _vtable(nullptr) {
+            typedef typename std::decay<F>::type Fn;
+            _construct<Fn>(std::forward<F>(f), std::integral_constant<bool, _fits_inline<Fn>()>());
+        };
+
+        Task(Task&& T) noexcept : _vtable(T._vtable) {
+            _copy_stamps(T);
+            if (_vtable) {
+                _vtable->move(&_storage, &T._storage);
+                T._vtable = nullptr;
             }
-            #else
-                resize(max_threads);
-            #endif
-        }; 
+        };
 
-        /**
-        *   Copy constructor.
-        */ 
-        ThreadPool(const ThreadPool &TP) = delete;
-        
-        /**
-        *   Deleted assignment operators
-        */
-        ThreadPool& operator = (ThreadPool&& TP) = delete;
-        ThreadPool& operator = (const ThreadPool& TP) = delete;
-    
-        /**
-        *   When the ThreadPool is deallocated,
-        *   the threads still running are joined().
-        */
-        ~ThreadPool() noexcept {
-            try {
-                if (_run_pool_thread) {
-                    _run_pool_thread = false;
-                    _threads_blocker.unblock(true);
-                    for (auto &t : _pool) {
-                        t.join();
-                    } 
+        Task& operator = (Task&& T) noexcept {
+            if (this != &T) {
+                _reset();
+                _copy_stamps(T);
+                if (T._vtable) {
+                    T._vtable->move(&_storage, &T._storage);
+                    _vtable = T._vtable;
+                    T._vtable = nullptr;
                 }
-            } catch (...) {}
-        };
+            }
+            return *this;
+        }
+
+        Task& operator = (std::nullptr_t) noexcept {
+            _reset();
+            return *this;
+        }
+
+        Task(const Task& T) = delete;
+        Task& operator = (const Task& T) = delete;
+
+        ~Task() { _reset(); };
 
-        /**
-        *   Update size for the thread pool;
-        *   the abs value of num_threads is taken.
-        */
         void
-        resize(int num_threads = std::thread::hardware_concurrency()) 
-        noexcept(false) {
-            if (!_run_pool_thread) return;
-            
-            #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.resize_alloc, 
-                [&](){ return num_threads < 1; });
-            #endif
+        operator()() {
+            _vtable->invoke(&_storage);
+        }
 
-            _sem_api.wait();
-            auto diff = abs(num_threads - _threads_count);
-            if (num_threads > _threads_count) {
-                for (auto i = 0; i < diff; ++i) _safe_thread_push();
-            } else {
-                for (auto i = 0; i < diff; ++i) _safe_thread_pop();
-            }
-            _threads_blocker.unblock();
-            _sem_api.signal();
+        explicit operator bool() const noexcept {
+            return _vtable != nullptr;
         }
 
         /**
-        *   Push a job to do in jobs queue.
-        *   Use lambda expressions in order to
-        *   load jobs.
+        *   True if the callable is cancellable
+        *   [IsCancellable] and has been cancelled.
         */
-        template<class F> ThreadPool&
-        push(F&& f) {
-            _safe_queue_push(f);
-            return *this;
+        bool
+        cancelled() const {
+            return _vtable && _vtable->cancelled && 
+                _vtable->cancelled(const_cast<Storage*>(&_storage));
         }
 
         /**
-        *   Push a job to do in jobs queue.
-        *   Use lambda expressions in order to
-        *   load jobs. Overload operator <<.
+        *   True if the callable has been 
+        *   stored in the inline buffer.
         */
-        template<class F> ThreadPool&
-        operator<<(F&& f) {
-            _safe_queue_push(f);
-            return *this;
-        } 
+        bool
+        is_inline() const noexcept {
+            return _vtable && _vtable->is_inline;
+        }
 
         /**
-        *   Push multiple jobs to do in jobs queue.
-        *   Use lambda expressions in order to
-        *   load jobs.
+        *   Pushed by the user through the overflow
+        *   policy: DropOldest may discard it. The
+        *   jobs pushed by the pool itself [graph
+        *   nodes, continuations, resumptions] are
+        *   never dropped.
         */
-        template<class F, class ...Args> ThreadPool&
-        push(const F&& f, Args... args) {
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            _unsafe_queue_push(f);
-            _unsafe_queue_push(args...);
-            lock.unlock();
-            return *this;
-        }
+        bool droppable = false;
 
+        #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
         /**
-        *   Insert and execute a task for a
-        *   count number of times, and wait until
-        *   execution is done.
+        *   Time the task entered a queue, 
+        *   for the queue wait histogram.
         */
-        template<class F> void
-        apply_for(const int count, F&& f) noexcept(false) {
-            #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.apply_it_num, 
-                [&](){ return count < 0; });
-            #endif
+        std::uint64_t enqueued_ns = 0;
+        #endif
 
-            std::atomic<int> counter(0); 
-            auto func = [&] () { f(); ++counter; };
-            
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            for (auto i = 0; i < count; ++i) _unsafe_queue_push_front(func);
-            lock.unlock();
-            
-            while (counter != count) {
-                std::this_thread::sleep_for(std::chrono::nanoseconds(_thread_sleep_time_ns));
-            }
-        }
+        #if TP_ENABLE_TRACING
+        /**
+        *   Flow id in the trace, with the pusher
+        *   thread in the high bits, and the label
+        *   given at push [see TraceLabel].
+        */
+        std::uint64_t trace_id = 0;
+        const char *label = nullptr;
+        /**
+        *   Dispatch group [0 for none] and 
+        *   Priority level of the job, for the 
+        *   task trace [see dump_task_trace].
+        */
+        std::uint32_t group = 0;
+        std::uint8_t priority = 1;
+        #endif
 
-        template<class F> void
-        apply_for_async(const int count, F&& f) noexcept(false) {
-            #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.apply_it_num, 
-                [&](){ return count < 0; });
-            #endif
-            
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            for (auto i = 0; i < count; ++i) _unsafe_queue_push(f);
-            lock.unlock();
-        }
+    private:
+        typedef typename std::aligned_storage<TP_TASK_INLINE_SIZE, 
+            alignof(std::max_align_t)>::type Storage;
 
         /**
-        *   Push a job in the queue and
-        *   return a future, so you can 
-        *   track and get the result of the lambda.
-        *
-        *   Inspired by vit-vit threadpool:
-        *   https://github.com/vit-vit/CTPL
+        *   Operations for a given callable type, 
+        *   one static table for each type.
         */
-        template<class F> auto
-        future_from_push(F&& f) -> decltype(std::future<decltype(f())>()) {
-            auto packaged_task_ptr = std::make_shared<std::packaged_task<decltype(f())()>>(f);
-            auto func = std::function<void()>([packaged_task_ptr]() {(*packaged_task_ptr)();});
-            _safe_queue_push(func);
-            return packaged_task_ptr->get_future();
-        }
+        struct VTable
+        {
+            void (*invoke)(Storage*);
+            void (*move)(Storage*, Storage*);
+            void (*destroy)(Storage*);
+            bool (*cancelled)(Storage*);
+            bool is_inline;
+        };
 
-        void
-        synchronize() {
-            _sem_job_ins_container.wait();
-        }
+        template<class Fn> static bool
+        _cancelled_of(const Fn &f, std::true_type) { return f.cancelled(); }
 
-        void
-        end_synchronize() {
-            _sem_job_ins_container.signal();
-        }
+        template<class Fn> static bool
+        _cancelled_of(const Fn&, std::false_type) { return false; }
 
-        void
-        awake() {
-            if (_run_pool_thread) return;
-            _run_pool_thread = true;
-            resize(_prev_threads);
-            _threads_blocker.deactivate_barrier();
+        template<class Fn> static constexpr bool
+        _fits_inline() {
+            return sizeof(Fn) <= sizeof(Storage) && 
+                alignof(Storage) % alignof(Fn) == 0 &&
+                std::is_nothrow_move_constructible<Fn>::value;
         }
 
-        /**
-        *   Stop execution, detach all
-        *   jobs under processing.
-        *   This is a thread blocking call.
-        */ 
-        void
-        stop() {
-            if (!_run_pool_thread) return;
-            _sem_api.wait();
-            _run_pool_thread = false;
-            _prev_threads = 0;
-
-            _threads_blocker.unblock(true);
-            
-            while(_threads_count != 0) {
-                ++_prev_threads;
-                _safe_thread_pop();
+        template<class Fn> struct InlineOps
+        {
+            static void invoke(Storage *s) { (*reinterpret_cast<Fn*>(s))(); }
+            static void move(Storage *d, Storage *s) { 
+                ::new (d) Fn(std::move(*reinterpret_cast<Fn*>(s)));
+                reinterpret_cast<Fn*>(s)->~Fn();
             }
-            while(_thread_to_kill_c != 0) {
-                std::this_thread::sleep_for(std::chrono::nanoseconds(_thread_sleep_time_ns));
+            static void destroy(Storage *s) { reinterpret_cast<Fn*>(s)->~Fn(); }
+            static bool cancelled(Storage *s) { 
+                return _cancelled_of(*reinterpret_cast<Fn*>(s), IsCancellable<Fn>()); 
             }
-            _sem_api.signal();
-        }
-
-        /**
-        *   Wait until all jobs
-        *   are computed.
-        *   This is a thread blocking call.
-        */
-        void
-        wait() {
-            if (!_run_pool_thread) return;
-            while((_push_c != 0)) {
-                std::this_thread::sleep_for(std::chrono::nanoseconds(_thread_sleep_time_ns));
+            static const VTable* table() {
+                static const VTable vt = { &invoke, &move, &destroy, 
+                    IsCancellable<Fn>::value ? &cancelled : nullptr, true };
+                return &vt;
             }
-        }
+        };
 
-        /**
-        *   Returning the current size of the 
-        *   thread pool.
-        */
-        int 
-        pool_size() const { 
-            return _threads_count; 
-        }
+        template<class Fn> struct HeapOps
+        {
+            static Fn*& ptr(Storage *s) { return *reinterpret_cast<Fn**>(s); }
+            static void invoke(Storage *s) { (*ptr(s))(); }
+            static void move(Storage *d, Storage *s) { 
+                ::new (d) Fn*(ptr(s));
+            }
+            static void destroy(Storage *s) { 
+                ptr(s)->~Fn();
+                PoolAllocator<Fn>().deallocate(ptr(s), 1);
+            }
+            static bool cancelled(Storage *s) { 
+                return _cancelled_of(*ptr(s), IsCancellable<Fn>()); 
+            }
+            static const VTable* table() {
+                static const VTable vt = { &invoke, &move, &destroy, 
+                    IsCancellable<Fn>::value ? &cancelled : nullptr, false };
+                return &vt;
+            }
+        };
 
-        size_t
-        queue_size() const {
-            return _push_c;
+        template<class Fn, class F> void
+        _construct(F&& f, std::true_type) {
+            ::new (&_storage) Fn(std::forward<F>(f));
+            _vtable = InlineOps<Fn>::table();
         }
 
-        bool 
-        queue_is_empty() const {
-            return _push_c == 0;
+        template<class Fn, class F> void
+        _construct(F&& f, std::false_type) {
+            Fn *p = PoolAllocator<Fn>().allocate(1);
+            try {
+                ::new (p) Fn(std::forward<F>(f));
+            } catch (...) {
+                PoolAllocator<Fn>().deallocate(p, 1);
+                throw;
+            }
+            ::new (&_storage) Fn*(p);
+            _vtable = HeapOps<Fn>::table();
         }
 
-        /**
-        *   Set the thread sleep time.
-        *   Interval is in nanoseconds.
-        */
         void
-        set_sleep_time_ns(const int time_ns) noexcept(false) {
-            #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.sleep_time, 
-                [&](){ return time_ns < 0; });
-            #endif
-            _thread_sleep_time_ns = time_ns;
+        _reset() noexcept {
+            if (_vtable) {
+                _vtable->destroy(&_storage);
+                _vtable = nullptr;
+            }
         }
 
-        /**
-        *   Set the thread sleep time.
-        *   Interval is in milliseconds.
-        */
         void
-        set_sleep_time_ms(const int time_ms) noexcept(false) {
-            #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.sleep_time, 
-                [&](){ return time_ms < 0; });
+        _copy_stamps(const Task &T) noexcept {
+            droppable = T.droppable;
+            #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
+            enqueued_ns = T.enqueued_ns;
+            #endif
+            #if TP_ENABLE_TRACING
+            trace_id = T.trace_id;
+            label = T.label;
+            group = T.group;
+            priority = T.priority;
             #endif
-            _thread_sleep_time_ns = time_ms * 1000000;
         }
 
-        /**
-        *   Set the thread sleep time.
-        *   Interval is in seconds
-        *   and can be a floating point value.
-        */
+        Storage _storage;
+        const VTable *_vtable;
+    };
+
+    /**
+    *   How the pool stores the pending jobs.
+    *
+    *   Global:       a single std::deque shared
+    *                 by every thread [default].
+    *   WorkStealing: each thread owns a deque, jobs
+    *                 pushed from a pool thread stay on
+    *                 its deque, idle threads steal from
+    *                 the others and jobs pushed from
+    *                 outside go to an injection queue.
+    *   RingBuffer:   a lock free bounded multi producer
+    *                 multi consumer ring; when it is full
+    *                 the jobs overflow in the global deque.
+    */
+    enum class QueueMode
+    {
+        Global,
+        WorkStealing,
+        RingBuffer
+    };
+
+    /**
+    *   Priority of a job. Higher levels are
+    *   served first, but a waiting level is
+    *   served at least once every 
+    *   TP_PRIORITY_AGING jobs of the levels
+    *   above it.
+    *   apply_for and parallel_for use High,
+    *   dg_now uses Critical; push uses Normal
+    *   when no priority is given.
+    */
+    enum class Priority
+    {
+        Low,
+        Normal,
+        High,
+        Critical
+    };
+
+    /**
+    *   How parallel_for splits the iteration
+    *   space in chunks, claimed by the pool
+    *   threads and by the caller.
+    *
+    *   Static:  one equal chunk per thread, the
+    *            grain is the minimum chunk size.
+    *   Dynamic: chunks of *grain* iterations.
+    *   Guided:  chunks proportional to the iterations
+    *            left, never smaller than *grain*.
+    *   Auto:    guided, with the grain chosen from
+    *            the range and the pool size [default].
+    */
+    enum class Partitioner
+    {
+        Static,
+        Dynamic,
+        Guided,
+        Auto
+    };
+
+    /**
+    *    _____                 _                   
+    *   |_   _|__  _ __   ___ | | ___   __ _ _   _ 
+    *     | |/ _ \| '_ \ / _ \| |/ _ \ / _` | | | |
+    *     | | (_) | |_) | (_) | | (_) | (_| | |_| |
+    *     |_|\___/| .__/ \___/|_|\___/ \__, |\__, |
+    *             |_|                  |___/ |___/ 
+    *
+    *
+    *   Where the pool threads run [set_affinity].
+    *
+    *   None:      no pinning, the OS decides [default].
+    *   Cores:     thread i is pinned to the i-th cpu 
+    *              of the list, round robin.
+    *   CoreSet:   every thread may run on any cpu
+    *              of the list.
+    *   NumaNodes: threads are spread round robin over
+    *              the NUMA nodes, each pinned to the
+    *              cpus of its node [in the list].
+    */
+    enum class Affinity
+    {
+        None,
+        Cores,
+        CoreSet,
+        NumaNodes
+    };
+
+    /**
+    *   Parse a Linux cpulist, e.g. "0-3,8,10-14:2",
+    *   in a sorted list of cpus. Return false if
+    *   the string is malformed.
+    */
+    inline bool
+    cpulist_parse(const std::string &list, std::vector<int> &cpus) {
+        cpus.clear();
+        size_t i = 0, n = list.size();
+        auto number = [&](int &v) -> bool {
+            if (i >= n || list[i] < '0' || list[i] > '9') return false;
+            v = 0;
+            while (i < n && list[i] >= '0' && list[i] <= '9') {
+                v = v * 10 + (list[i++] - '0');
+                if (v > 1 << 20) return false;
+            }
+            return true;
+        };
+        while (n > 0 && (list[n - 1] == '\n' || list[n - 1] == ' ')) --n;
+        while (i < n) {
+            int first, last, stride = 1;
+            if (!number(first)) return false;
+            last = first;
+            if (i < n && list[i] == '-') {
+                ++i;
+                if (!number(last) || last < first) return false;
+                if (i < n && list[i] == ':') {
+                    ++i;
+                    if (!number(stride) || stride == 0) return false;
+                }
+            }
+            for (int c = first; c <= last; c += stride) cpus.push_back(c);
+            if (i < n && list[i++] != ',') return false;
+        }
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        return true;
+    }
+
+    /**
+    *   The cpus of each NUMA node, in order of node
+    *   id, read from /sys/devices/system/node. When
+    *   it is not available the machine is a single
+    *   node with hardware_concurrency cpus.
+    */
+    inline std::vector<std::vector<int> >
+    numa_topology() {
+        std::vector<std::vector<int> > nodes;
+        std::string line;
+        std::vector<int> ids, cpus;
+        std::ifstream online("/sys/devices/system/node/online");
+        if (std::getline(online, line) && cpulist_parse(line, ids)) {
+            for (auto id : ids) {
+                std::ifstream f("/sys/devices/system/node/node" + 
+                    std::to_string(id) + "/cpulist");
+                if (std::getline(f, line) && cpulist_parse(line, cpus) && !cpus.empty()) {
+                    nodes.push_back(cpus);
+                }
+            }
+        }
+        if (nodes.empty()) {
+            int c = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            nodes.push_back(std::vector<int>());
+            for (int i = 0; i < c; ++i) nodes.back().push_back(i);
+        }
+        return nodes;
+    }
+
+    /**
+    *   How the pool resizes itself when the
+    *   autoscaler is enabled [enable_autoscale].
+    *
+    *   Every *interval* the load is sampled. The
+    *   pool is behind when the queued jobs are at
+    *   least *backlog_per_thread* for each thread, 
+    *   or when the queue wait estimated from the
+    *   throughput exceeds *max_queue_wait*: after
+    *   *grow_samples* samples in a row behind, it
+    *   grows up to doubling, never over 
+    *   *max_threads*. The threads that stayed idle
+    *   for a whole *keep_alive* are retired, never 
+    *   under *min_threads*.
+    */
+    struct AutoscalePolicy
+    {
+        AutoscalePolicy(int min = 1, int max = std::max(1, hwc()),
+            std::chrono::milliseconds keep = std::chrono::milliseconds(1000)) :
+            min_threads(min),
+            max_threads(max),
+            keep_alive(keep),
+            interval(std::chrono::milliseconds(10)),
+            max_queue_wait(std::chrono::milliseconds(5)),
+            backlog_per_thread(4),
+            grow_samples(2) {};
+
+        int min_threads;
+        int max_threads;
+        std::chrono::milliseconds keep_alive;
+        std::chrono::milliseconds interval;
+        std::chrono::milliseconds max_queue_wait;
+        int backlog_per_thread;
+        int grow_samples;
+    };
+
+    /**
+    *   Counters of one thread of the pool, or
+    *   their sum [see ThreadPool::stats()]. 
+    *   Stolen counts the jobs taken from the 
+    *   deque of another thread, parks the times
+    *   the thread went to sleep. Times are in ns,
+    *   idle time includes spin and park time.
+    */
+    struct ThreadStats
+    {
+        ThreadStats() : 
+            executed(0), stolen(0), parks(0), idle_ns(0), park_ns(0) {};
+
+        std::uint64_t executed;
+        std::uint64_t stolen;
+        std::uint64_t parks;
+        std::uint64_t idle_ns;
+        std::uint64_t park_ns;
+
+        ThreadStats& operator += (const ThreadStats &o) {
+            executed += o.executed;
+            stolen += o.stolen;
+            parks += o.parks;
+            idle_ns += o.idle_ns;
+            park_ns += o.park_ns;
+            return *this;
+        }
+    };
+
+    /**
+    *   Histogram of durations in log2 buckets:
+    *   bucket i counts the values in [2^i, 2^(i+1))
+    *   ns, bucket 0 also the zeros.
+    */
+    struct LatencyHistogram
+    {
+        LatencyHistogram() : buckets(TP_METRICS_BUCKETS, 0) {};
+
+        std::vector<std::uint64_t> buckets;
+
+        std::uint64_t
+        count() const {
+            std::uint64_t n = 0;
+            for (auto b : buckets) n += b;
+            return n;
+        }
+
+        /**
+        *   Upper bound in ns of the bucket holding
+        *   the p quantile, p in [0, 1]; 0 if empty.
+        */
+        std::uint64_t
+        percentile(double p) const {
+            std::uint64_t n = count();
+            if (n == 0) return 0;
+            double r = p * static_cast<double>(n);
+            std::uint64_t rank = static_cast<std::uint64_t>(r);
+            if (static_cast<double>(rank) < r) ++rank;
+            if (rank == 0) rank = 1;
+            std::uint64_t seen = 0;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                seen += buckets[i];
+                if (seen >= rank) return (std::uint64_t(2) << i) - 1;
+            }
+            return (std::uint64_t(2) << (buckets.size() - 1)) - 1;
+        }
+
+        LatencyHistogram& operator += (const LatencyHistogram &o) {
+            for (size_t i = 0; i < buckets.size() && i < o.buckets.size(); ++i) 
+                buckets[i] += o.buckets[i];
+            return *this;
+        }
+
+        static size_t
+        bucket(std::uint64_t ns) {
+            size_t b = 0;
+            while (ns > 1 && b + 1 < TP_METRICS_BUCKETS) {
+                ns >>= 1;
+                ++b;
+            }
+            return b;
+        }
+    };
+
+    /**
+    *   Snapshot of a pool [see ThreadPool::stats()].
+    *   Workers holds the active threads, total also
+    *   the retired ones. The queue high water mark
+    *   is the deepest queue seen by a thread when 
+    *   taking a job.
+    */
+    struct PoolStats
+    {
+        PoolStats() : threads(0), queue_size(0), queue_high_water(0), capacity(0), dropped(0),
+            memory(0), memory_cached(0) {};
+
+        int threads;
+        size_t queue_size;
+        size_t queue_high_water;
+        /**
+        *   Capacity of the pool [0 if unbounded]
+        *   and jobs dropped by DropOldest.
+        */
+        size_t capacity;
+        std::uint64_t dropped;
+        /**
+        *   Bytes of the task nodes taken from the
+        *   system [shared by all the pools, see 
+        *   NodePool] plus the ring of this pool,
+        *   and the free nodes cached for reuse.
+        */
+        size_t memory;
+        size_t memory_cached;
+        ThreadStats total;
+        std::vector<ThreadStats> workers;
+        LatencyHistogram queue_wait;
+        LatencyHistogram run_time;
+    };
+
+    /**
+    *   What a push does when the pool is at its
+    *   capacity [see ThreadPool::set_capacity].
+    *
+    *   Block:      the producer sleeps until a
+    *               job of the pool completes.
+    *   DropOldest: the oldest queued job of the 
+    *               lowest priority is dropped to
+    *               make room; if there is none 
+    *               to drop, as Block.
+    *   CallerRuns: the producer runs the job.
+    */
+    enum class OverflowPolicy
+    {
+        Block,
+        DropOldest,
+        CallerRuns
+    };
+
+    /**
+    *   Id of a pending timer, returned by 
+    *   ThreadPool::push_after, push_at and 
+    *   push_every, to cancel it. Never zero.
+    */
+    typedef std::uint64_t TimerId;
+
+    /**
+    *   Cooperative cancellation: the jobs pushed
+    *   with a token [ThreadPool::push(token, f)]
+    *   that have not started when it is cancelled
+    *   are dropped by the pool without running,
+    *   the running ones can poll it. The copies
+    *   share the same state.
+    */
+    class CancellationToken
+    {
+    public:
+        CancellationToken() : _state(std::make_shared<std::atomic<bool> >(false)) {};
+
+        void
+        cancel() noexcept {
+            _state->store(true, std::memory_order_release);
+        }
+
+        bool
+        is_cancelled() const noexcept {
+            return _state->load(std::memory_order_acquire);
+        }
+
+    private:
+        std::shared_ptr<std::atomic<bool> > _state;
+    };
+
+    /**
+    *   Name of a job in the trace, given at push
+    *   [see ThreadPool::enable_tracing()]. The 
+    *   string is not copied: it must outlive the
+    *   dump, e.g. a literal.
+    */
+    struct TraceLabel
+    {
+        explicit TraceLabel(const char *n) : name(n) {};
+
+        const char *name;
+    };
+
+    /**
+    *   A job of a task trace [see 
+    *   ThreadPool::dump_task_trace()]: when it
+    *   entered the queue, from the first job of 
+    *   the trace, how long it waited and ran, its
+    *   dispatch group [0 for none] and priority.
+    */
+    struct TaskTraceRecord
+    {
+        TaskTraceRecord() : 
+            arrival_ns(0), wait_ns(0), duration_ns(0), group(0), priority(Priority::Normal) {};
+
+        std::uint64_t arrival_ns;
+        std::uint64_t wait_ns;
+        std::uint64_t duration_ns;
+        std::uint32_t group;
+        Priority priority;
+    };
+
+    /**
+    *   Binary format of the task traces: the 
+    *   magic "ASTPTT01", the number of jobs, then
+    *   for each job, sorted by arrival, the delta
+    *   from the previous arrival, the wait, the
+    *   duration and the group as LEB128 varints
+    *   and the priority as one byte.
+    */
+    inline void
+    task_trace_write(std::ostream &os, const std::vector<TaskTraceRecord> &jobs) {
+        auto put = [&os](std::uint64_t v) {
+            do {
+                unsigned char b = v & 0x7f;
+                v >>= 7;
+                os.put(static_cast<char>(v ? b | 0x80 : b));
+            } while (v);
+        };
+        os.write("ASTPTT01", 8);
+        put(jobs.size());
+        std::uint64_t prev = 0;
+        for (auto &j : jobs) {
+            put(j.arrival_ns >= prev ? j.arrival_ns - prev : 0);
+            prev = std::max(prev, j.arrival_ns);
+            put(j.wait_ns);
+            put(j.duration_ns);
+            put(j.group);
+            os.put(static_cast<char>(j.priority));
+        }
+    }
+
+    /**
+    *   Read a task trace written by 
+    *   task_trace_write. Return false if the 
+    *   stream is not a valid trace.
+    */
+    inline bool
+    task_trace_read(std::istream &is, std::vector<TaskTraceRecord> &jobs) {
+        jobs.clear();
+        auto get = [&is](std::uint64_t &v) -> bool {
+            v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                int c = is.get();
+                if (c == std::char_traits<char>::eof()) return false;
+                v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+                if (!(c & 0x80)) return true;
+            }
+            return false;
+        };
+        char magic[8];
+        if (!is.read(magic, 8) || std::string(magic, 8) != "ASTPTT01") return false;
+        std::uint64_t n, arrival = 0;
+        if (!get(n)) return false;
+        jobs.reserve(static_cast<size_t>(std::min<std::uint64_t>(n, 1 << 20)));
+        for (std::uint64_t i = 0; i < n; ++i) {
+            TaskTraceRecord j;
+            std::uint64_t delta, group;
+            if (!get(delta) || !get(j.wait_ns) || !get(j.duration_ns) || !get(group)) return false;
+            int prio = is.get();
+            if (prio < 0 || prio > static_cast<int>(Priority::Critical)) return false;
+            arrival += delta;
+            j.arrival_ns = arrival;
+            j.group = static_cast<std::uint32_t>(group);
+            j.priority = static_cast<Priority>(prio);
+            jobs.push_back(j);
+        }
+        return true;
+    }
+
+    /**
+    *    _____      _                  
+    *   |  ___|   _| |_ _   _ _ __ ___ 
+    *   | |_ | | | | __| | | | '__/ _ \
+    *   |  _|| |_| | |_| |_| | | |  __/
+    *   |_|   \__,_|\__|\__,_|_|  \___|
+    *
+    *
+    *   Storage of the value of a future,
+    *   empty for void.
+    */
+    template<class T> class FutureStorage
+    {
+    public:
+        FutureStorage() : _has_value(false) {};
+        FutureStorage(const FutureStorage&) = delete;
+        FutureStorage& operator = (const FutureStorage&) = delete;
+        ~FutureStorage() {
+            if (_has_value) _ptr()->~T();
+        }
+
+        template<class ...A> void
+        set(A&&... a) {
+            new (&_storage) T(std::forward<A>(a)...);
+            _has_value = true;
+        }
+
+        T
+        take() {
+            return std::move(*_ptr());
+        }
+
+    private:
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+        bool _has_value;
+
+        T*
+        _ptr() {
+            return reinterpret_cast<T*>(&_storage);
+        }
+    };
+
+    template<> class FutureStorage<void>
+    {
+    public:
+        void set() {}
+        void take() {}
+    };
+
+    /**
+    *   State shared by a Future and the job 
+    *   that computes its value. The continuations
+    *   are run by the thread that sets the value,
+    *   they only push the real work to the pool.
+    */
+    template<class T> class FutureState
+    {
+    public:
+        FutureState() : _ready(false), _phase(_pending) {};
+        FutureState(const FutureState&) = delete;
+        FutureState& operator = (const FutureState&) = delete;
+        ~FutureState() {};
+
+        template<class ...A> void
+        set_value(A&&... a) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_ready) return;
+            _storage.set(std::forward<A>(a)...);
+            _set_ready(lock);
+        }
+
+        void
+        set_exception(std::exception_ptr e) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_ready) return;
+            _error = e;
+            _set_ready(lock);
+        }
+
+        bool
+        is_ready() const {
+            return _ready;
+        }
+
+        /**
+        *   Claim the state for the job computing
+        *   it. False if it was cancelled first.
+        */
+        bool
+        start() {
+            int p = _pending;
+            return _phase.compare_exchange_strong(p, _running);
+        }
+
+        /**
+        *   Cancel the job computing the state if
+        *   it has not started: the state gets an
+        *   exception. False if the job started or
+        *   the state is ready.
+        */
+        bool
+        cancel() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            int p = _pending;
+            if (_ready || !_phase.compare_exchange_strong(p, _cancelled)) return false;
+            _error = std::make_exception_ptr(std::runtime_error("ThreadPool: the task was cancelled"));
+            _set_ready(lock);
+            return true;
+        }
+
+        bool
+        cancelled() const {
+            return _phase.load(std::memory_order_relaxed) == _cancelled;
+        }
+
+        void
+        wait() {
+            if (_ready) return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _ready.load(); });
+        }
+
+        template<class C, class D> bool
+        wait_until(const std::chrono::time_point<C, D>& t) {
+            if (_ready) return true;
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _cv.wait_until(lock, t, [this]() { return _ready.load(); });
+        }
+
+        /**
+        *   Wait the value and move it out, or 
+        *   rethrow the stored exception.
+        */
+        T
+        take() noexcept(false) {
+            wait();
+            if (_error) std::rethrow_exception(_error);
+            return _storage.take();
+        }
+
+        /**
+        *   Run *t* when the state is ready, now
+        *   if it already is.
+        */
+        void
+        on_ready(Task&& t) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_ready) {
+                _continuations.push_back(std::move(t));
+                return;
+            }
+            lock.unlock();
+            t();
+        }
+
+    private:
+        static const int _pending = 0;
+        static const int _running = 1;
+        static const int _cancelled = 2;
+
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::atomic<bool> _ready;
+        std::atomic<int> _phase;
+        std::exception_ptr _error;
+        FutureStorage<T> _storage;
+        std::vector<Task> _continuations;
+
+        void
+        _set_ready(std::unique_lock<std::mutex>& lock) {
+            _ready = true;
+            _cv.notify_all();
+            std::vector<Task> c(std::move(_continuations));
+            lock.unlock();
+            for (auto &t : c) t();
+        }
+    };
+
+    /**
+    *   Set the value of a state with the result 
+    *   of f(a...), also when it returns void.
+    */
+    template<class T> struct FutureFulfill
+    {
+        template<class F, class ...A> static void
+        run(FutureState<T>& s, F& f, A&&... a) {
+            s.set_value(f(std::forward<A>(a)...));
+        }
+    };
+
+    template<> struct FutureFulfill<void>
+    {
+        template<class F, class ...A> static void
+        run(FutureState<void>& s, F& f, A&&... a) {
+            f(std::forward<A>(a)...);
+            s.set_value();
+        }
+    };
+
+    template<class T> class Future;
+
+    #if TP_ENABLE_COROUTINES
+    template<class T> class task;
+    #endif
+
+    /**
+    *    _____         _     ____                 _     
+    *   |_   _|_ _ ___| | __/ ___|_ __ __ _ _ __ | |__  
+    *     | |/ _` / __| |/ / |  _| '__/ _` | '_ \| '_ \ 
+    *     | | (_| \__ \   <| |_| | | | (_| | |_) | | | |
+    *     |_|\__,_|___/_|\_\\____|_|  \__,_| .__/|_| |_|
+    *                                      |_|          
+    *
+    *   Graph of jobs with dependencies: a node 
+    *   is pushed to the pool when all the nodes
+    *   that precede it have run. A graph can be
+    *   submitted again once it has finished.
+    */
+    class TaskGraph
+    {
+        struct Node
+        {
+            Node(Task&& t) : work(std::move(t)), dependencies(0), pending(0) {};
+
+            Task work;
+            std::vector<Node*> successors;
+            int dependencies;
+            std::atomic<int> pending;
+        };
+
+    public:
+        /**
+        *   Handle to a node of a graph, valid
+        *   as long as the graph.
+        */
+        class TaskNode
+        {
+        public:
+            TaskNode() : _node(nullptr) {};
+
+            /**
+            *   *n* will run after this node.
+            */
+            TaskNode&
+            precede(TaskNode n) {
+                _node->successors.push_back(n._node);
+                ++n._node->dependencies;
+                return *this;
+            }
+
+            /**
+            *   This node will run after *n*.
+            */
+            TaskNode&
+            succeed(TaskNode n) {
+                n.precede(*this);
+                return *this;
+            }
+
+        private:
+            friend class TaskGraph;
+            TaskNode(Node *n) : _node(n) {};
+            Node *_node;
+        };
+
+        TaskGraph() : 
+            _running(false), 
+            _remaining(0), 
+            _failed(false) {};
+        TaskGraph(const TaskGraph&) = delete;
+        TaskGraph& operator = (const TaskGraph&) = delete;
+
+        /**
+        *   A running graph is waited, its
+        *   nodes are still referenced by the pool.
+        */
+        ~TaskGraph() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return !_running; });
+        }
+
+        /**
+        *   Add a node that runs f. The graph 
+        *   must not be running.
+        */
+        template<class F> TaskNode
+        emplace(F&& f) {
+            _nodes.emplace_back(new Node(Task(std::forward<F>(f))));
+            return TaskNode(_nodes.back().get());
+        }
+
+        size_t
+        size() const {
+            return _nodes.size();
+        }
+
+        bool
+        is_running() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _running;
+        }
+
+        /**
+        *   Block until the submitted run is over,
+        *   than rethrow the first exception thrown
+        *   by a node. After an exception the 
+        *   remaining nodes are skipped.
+        */
+        void
+        wait() noexcept(false) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return !_running; });
+            std::exception_ptr e = _error;
+            _error = nullptr;
+            lock.unlock();
+            if (e) std::rethrow_exception(e);
+        }
+
+    private:
+        friend class ThreadPool;
+        std::vector<std::unique_ptr<Node> > _nodes;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _running;
+        std::atomic<int> _remaining;
+        std::atomic<bool> _failed;
+        std::exception_ptr _error;
+
+        /**
+        *   True if the dependencies have no
+        *   cycles [Kahn's algorithm].
+        */
+        bool
+        _is_acyclic() const {
+            std::map<const Node*, int> deps;
+            std::vector<const Node*> ready;
+            for (auto &n : _nodes) {
+                deps[n.get()] = n->dependencies;
+                if (n->dependencies == 0) ready.push_back(n.get());
+            }
+            size_t visited = 0;
+            while (!ready.empty()) {
+                const Node *n = ready.back();
+                ready.pop_back();
+                ++visited;
+                for (auto s : n->successors) {
+                    if (--deps[s] == 0) ready.push_back(s);
+                }
+            }
+            return visited == _nodes.size();
+        }
+
+        /**
+        *   Reset the counters for a new run,
+        *   return false if it is already running.
+        */
+        bool
+        _start() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_running) return false;
+            _running = true;
+            _failed = false;
+            _error = nullptr;
+            _remaining = static_cast<int>(_nodes.size());
+            for (auto &n : _nodes) n->pending = n->dependencies;
+            return true;
+        }
+
+        void
+        _run_node(Node &n) {
+            if (_failed) return;
+            try {
+                n.work();
+            } catch(...) {
+                if (!_failed.exchange(true)) _error = std::current_exception();
+            }
+        }
+
+        /**
+        *   The last node signals under the lock,
+        *   so the graph can be destroyed as soon
+        *   as wait returns.
+        */
+        void
+        _node_done() {
+            if (--_remaining != 0) return;
+            std::unique_lock<std::mutex> lock(_mutex);
+            _running = false;
+            _cv.notify_all();
+        }
+    };
+
+    /**
+    *   Structure of the class:
+    *
+    *   private:
+    *       - Nested Semaphore class
+    *       - Nested EventCount class
+    *       - Nested CountdownLatch class
+    *       - Nested ForState class
+    *       - Nested ReduceSlot struct
+    *       - Nested DispatchGroup class
+    *       - Nested ThreadsBlocker class
+    *       - Nested WorkStealingDeque class
+    *       - Nested RingBuffer class
+    *       - Nested PriorityQueue class
+    *       - Nested Worker struct
+    *
+    *   public:
+    *       - API
+    *
+    *   private:
+    *       - All the class variables and
+    *         methods
+    *   
+    *   Enjoy!
+    */
+    class ThreadPool
+    {
+        template<class T> friend class Future;
+        template<class F, class T, class R> friend struct ThenJob;
+
+    private:
+        /**
+        *    ____                             _                    
+        *   / ___|  ___ _ __ ___   __ _ _ __ | |__   ___  _ __ ___ 
+        *   \___ \ / _ \ '_ ` _ \ / _` | '_ \| '_ \ / _ \| '__/ _ \
+        *    ___) |  __/ | | | | | (_| | |_) | | | | (_) | | |  __/
+        *   |____/ \___|_| |_| |_|\__,_| .__/|_| |_|\___/|_|  \___|
+        *                              |_|                         
+        *
+        *
+        *   Nested ThreadPool class 
+        *   that represents a semaphore
+        *   in order to make the ThreadPool thread safe.
+        */
+        class Semaphore
+        {
+        public:
+            Semaphore(int value) : _value(value) {};
+            Semaphore(const Semaphore &S) : _mutex(), _cv() {};
+            Semaphore& operator=(Semaphore S) {return *this;}
+            ~Semaphore() {};
+    
+            void
+            wait() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                --_value;
+                if (_value < 0) {
+                    do {
+                        _cv.wait(lock);
+                    } while (_wake_ups < 1);
+                    --_wake_ups;
+                }
+            }
+ 
+            void 
+            signal() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_value;
+                if (_value <= 0) {
+                    ++_wake_ups;
+                    _cv.notify_one();
+                }
+            }
+    
+        private:
+            int _value;
+            int _wake_ups = 0;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+        };
+
+        /**
+        *   Lets threads block until a condition
+        *   on some atomic state becomes true.
+        *   The state is changed without taking any 
+        *   lock, and notify_all() costs one atomic
+        *   load when nobody is waiting.
+        *   The object must outlive the notifiers,
+        *   see CountdownLatch for stack objects.
+        */
+        class EventCount
+        {
+        public:
+            EventCount() : _waiters(0) {};
+            EventCount(const EventCount&) = delete;
+            EventCount& operator = (const EventCount&) = delete;
+            ~EventCount() {};
+
+            /**
+            *   Block until pred() returns true.
+            *   The predicate must read state that
+            *   is changed before notify_all().
+            */
+            template<class P> void
+            wait(P&& pred) {
+                if (pred()) return;
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_waiters;
+                _cv.wait(lock, pred);
+                --_waiters;
+            }
+
+            /**
+            *   As wait, giving up at *t*. Return 
+            *   pred() at the end.
+            */
+            template<class P, class C, class D> bool
+            wait_until(P&& pred, const std::chrono::time_point<C, D> &t) {
+                if (pred()) return true;
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_waiters;
+                bool ready = _cv.wait_until(lock, t, pred);
+                --_waiters;
+                return ready;
+            }
+
+            void
+            notify_all() {
+                if (_waiters == 0) return;
+                { std::unique_lock<std::mutex> lock(_mutex); }
+                _cv.notify_all();
+            }
+
+        private:
+            std::atomic<int> _waiters;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+        };
+
+        /**
+        *   Single use countdown: wait() returns
+        *   when count_down() has been called 
+        *   *count* times. The last notifier signals
+        *   while holding the mutex, so the latch
+        *   can live on the waiter's stack.
+        */
+        class CountdownLatch
+        {
+        public:
+            CountdownLatch(std::ptrdiff_t count) : 
+                _count(count),
+                _done(count <= 0) {};
+            CountdownLatch(const CountdownLatch&) = delete;
+            CountdownLatch& operator = (const CountdownLatch&) = delete;
+            ~CountdownLatch() {};
+
+            void
+            count_down(std::ptrdiff_t n = 1) {
+                if (_count.fetch_sub(n) != n) return;
+                std::unique_lock<std::mutex> lock(_mutex);
+                _done = true;
+                _cv.notify_all();
+            }
+
+            void
+            wait() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _done; });
+            }
+
+            bool
+            is_done() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _done;
+            }
+
+        private:
+            std::atomic<std::ptrdiff_t> _count;
+            bool _done;
+            std::mutex _mutex;
+            std::condition_variable _cv;
+        };
+
+        /**
+        *   Job that counts down a latch when it
+        *   is destroyed, that is after the pool
+        *   has run it and updated its counters,
+        *   even if the callable threw.
+        */
+        template<class F> struct LatchJob
+        {
+            LatchJob(F &f, CountdownLatch &l) : func(&f), latch(&l) {};
+            LatchJob(LatchJob&& J) noexcept : func(J.func), latch(J.latch) {
+                J.latch = nullptr;
+            };
+            LatchJob(const LatchJob& J) = delete;
+            ~LatchJob() { 
+                if (latch) latch->count_down(); 
+            };
+
+            void 
+            operator()() {
+                (*func)();
+            }
+
+            F *func;
+            CountdownLatch *latch;
+        };
+
+        /**
+        *   Shared state of a parallel_for: the 
+        *   participants claim chunks of [first, first + n)
+        *   through an atomic offset, and count down 
+        *   the latch by the iterations of each chunk.
+        *   It is owned by shared pointers, so helper
+        *   jobs that start late find nothing to do
+        *   and never touch the caller's callable.
+        */
+        template<class I, class F> class ForState
+        {
+        public:
+            ForState(I first, size_t n, size_t chunk, bool guided, 
+                size_t parts, F &f) :
+                _first(first),
+                _n(n),
+                _chunk(chunk),
+                _guided(guided),
+                _parts(parts),
+                _func(&f),
+                _next(0),
+                _failed(false),
+                _latch(static_cast<std::ptrdiff_t>(n)) {};
+            ForState(const ForState&) = delete;
+            ForState& operator = (const ForState&) = delete;
+            ~ForState() {};
+
+            /**
+            *   Run chunks until the range is over.
+            *   After the first exception the chunks
+            *   are only counted, not computed.
+            */
+            void
+            run() {
+                size_t b, e;
+                while (_claim(b, e)) {
+                    if (!_failed) {
+                        try {
+                            _call(*_func, _first + b, _first + e, 0);
+                        } catch(...) {
+                            if (!_failed.exchange(true)) {
+                                _error = std::current_exception();
+                            }
+                        }
+                    }
+                    _latch.count_down(static_cast<std::ptrdiff_t>(e - b));
+                }
+            }
+
+            /**
+            *   Wait every iteration, than rethrow 
+            *   the first exception, if any.
+            */
+            void
+            wait() noexcept(false) {
+                _latch.wait();
+                if (_error) std::rethrow_exception(_error);
+            }
+
+        private:
+            I _first;
+            size_t _n;
+            size_t _chunk;
+            bool _guided;
+            size_t _parts;
+            F *_func;
+            std::atomic<size_t> _next;
+            std::atomic<bool> _failed;
+            std::exception_ptr _error;
+            CountdownLatch _latch;
+
+            bool
+            _claim(size_t &b, size_t &e) {
+                if (!_guided) {
+                    b = _next.fetch_add(_chunk);
+                    if (b >= _n) return false;
+                    e = std::min(_n, b + _chunk);
+                    return true;
+                }
+                size_t cur = _next.load();
+                while (cur < _n) {
+                    size_t c = std::max(_chunk, (_n - cur) / (2 * _parts));
+                    size_t end = std::min(_n, cur + c);
+                    if (_next.compare_exchange_weak(cur, end)) {
+                        b = cur;
+                        e = end;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /**
+            *   Call a range body f(b, e) if the callable
+            *   accepts it, otherwise f(i) for each i.
+            */
+            template<class G> static auto
+            _call(G &f, I b, I e, int) -> decltype(f(b, e), void()) {
+                f(b, e);
+            }
+
+            template<class G> static void
+            _call(G &f, I b, I e, long) {
+                for (I i = b; i != e; ++i) f(i);
+            }
+        };
+
+        /**
+        *   Partial result of a parallel_reduce
+        *   chunk, padded so that two slots never
+        *   share a cache line.
+        */
+        template<class T> struct ReduceSlot
+        {
+            ReduceSlot(const T& t) : value(t) {};
+
+            T value;
+            char _pad[TP_CACHE_LINE_SIZE];
+        };
+
+        /**
+        *    ____  _                 _       _      ____                       
+        *   |  _ \(_)___ _ __   __ _| |_ ___| |__  / ___|_ __ ___  _   _ _ __  
+        *   | | | | / __| '_ \ / _` | __/ __| '_ \| |  _| '__/ _ \| | | | '_ \ 
+        *   | |_| | \__ \ |_) | (_| | || (__| | | | |_| | | | (_) | |_| | |_) |
+        *   |____/|_|___/ .__/ \__,_|\__\___|_| |_|\____|_|  \___/ \__,_| .__/ 
+        *               |_|                                             |_|    
+        *   
+        *
+        *   Nested ThreadPool class 
+        *   that stores informations
+        *   about dispatch groups.
+        */
+        class DispatchGroup : public std::enable_shared_from_this<DispatchGroup>
+        {
+        public:
+            /**
+            *   The group starts with one pending
+            *   "open" token, released by close: so
+            *   it can't finish while jobs are 
+            *   still being inserted.
+            */
+            DispatchGroup(std::string id = std::string()) : 
+                _id(std::move(id)), 
+                _closed(false),
+                _has_finished(false),
+                _cancelled(false),
+                _pending_c(1),
+                _sem_sync(Semaphore(1)) {
+                #if TP_ENABLE_TRACING
+                static std::atomic<std::uint32_t> seq{0};
+                _trace_group = ++seq;
+                #endif
+            };
+            DispatchGroup(DispatchGroup&& DP) = delete;
+            DispatchGroup& operator = (DispatchGroup&& DP) = delete;
+            DispatchGroup(const DispatchGroup& DP) = delete;
+            DispatchGroup& operator = (const DispatchGroup& DP) = delete;
+
+            ~DispatchGroup() {};
+
+            /**
+            *   Close the group and move its jobs
+            *   out, so they can be pushed in the 
+            *   pool. Return false if the group 
+            *   was already closed.
+            */
+            bool 
+            leave(std::vector<Task>& jobs)  {
+                std::unique_lock<std::mutex> lock(_mutex_jobs);
+                if (_closed) return false;
+                _closed = true;
+                jobs = std::move(_jobs);
+                return true;
+            }
+
+            template<class T> bool 
+            leave(std::vector<Task>& jobs, T&& t)  {
+                std::unique_lock<std::mutex> lock(_mutex_jobs);
+                if (_closed) return false;
+                _end_action = std::forward<T>(t);
+                _closed = true;
+                jobs = std::move(_jobs);
+                return true;
+            }
+
+            /**
+            *   Release the "open" token, must be
+            *   called once after a successful leave,
+            *   when the jobs are in the pool.
+            */
+            void
+            release() {
+                _signal_end_of_job();
+            }
+
+            bool
+            is_leave() const { 
+                return _closed; 
+            }
+
+            template<class F> bool
+            insert(F&& f)  {
+                std::unique_lock<std::mutex> lock(_mutex_jobs);
+                if (_closed) return false;
+                typedef typename std::decay<F>::type Fn;
+                ++_pending_c;
+                _jobs.emplace_back(Job<Fn>(std::forward<F>(f), shared_from_this()));
+                #if TP_ENABLE_TRACING
+                _jobs.back().group = _trace_group;
+                #endif
+                return true;
+            }
+
+            bool
+            has_finished() const {
+                return _has_finished;
+            }
+
+            /**
+            *   Drop the jobs of the group that have 
+            *   not started, also the ones inserted 
+            *   later. The group still finishes, with
+            *   its end action.
+            */
+            void
+            cancel() {
+                _cancelled = true;
+            }
+
+            bool
+            is_cancelled() const {
+                return _cancelled;
+            }
+
+            /**
+            *   Block the caller until the group
+            *   has finished (end action included).
+            */
+            void
+            wait() {
+                if (_has_finished) return;
+                std::unique_lock<std::mutex> lock(_mutex_done);
+                _cv_done.wait(lock, [this] { return _has_finished.load(); });
+            }
+
+            /**
+            *   Run *t* when the group has finished, 
+            *   now if it already has.
+            */
+            void
+            on_finish(Task&& t) {
+                std::unique_lock<std::mutex> lock(_mutex_done);
+                if (!_has_finished) {
+                    _on_finish.push_back(std::move(t));
+                    return;
+                }
+                lock.unlock();
+                t();
+            }
+
+            std::string
+            id() const { 
+                return _id; 
+            }
+
+            /**
+            *   Number of jobs not yet completed.
+            */
+            int
+            jobs_count() const { 
+                int c = _pending_c;
+                return _closed ? c : c - 1; 
+            }
+
+            void
+            synchronize() {
+                _sem_sync.wait();
+            }
+
+            void
+            end_synchronize() {
+                _sem_sync.signal();
+            }
+            
+        private:
+            std::string _id;
+            #if TP_ENABLE_TRACING
+            /**
+            *   Number of the group in the task trace.
+            */
+            std::uint32_t _trace_group;
+            #endif
+            /**
+            *   A job of the group: runs the user's
+            *   callable, than signals the group.
+            *   A job destroyed without running 
+            *   still signals it, so the group 
+            *   can't hang.
+            */
+            template<class F> struct Job
+            {
+                Job(F&& f, std::shared_ptr<DispatchGroup> g) : 
+                    func(std::move(f)), group(std::move(g)) {};
+                Job(const F& f, std::shared_ptr<DispatchGroup> g) : 
+                    func(f), group(std::move(g)) {};
+                Job(Job&& J) noexcept : 
+                    func(std::move(J.func)), group(std::move(J.group)) {};
+                Job(const Job& J) = delete;
+                ~Job() {
+                    if (!group) return;
+                    try { group->_signal_end_of_job(); } catch(...) {}
+                }
+
+                void 
+                operator()() {
+                    std::shared_ptr<DispatchGroup> g(std::move(group));
+                    try {
+                        if (!g->_cancelled) func();
+                    } catch(...) {
+                        g->_signal_end_of_job();
+                        throw;
+                    }
+                    g->_signal_end_of_job();
+                }
+
+                bool
+                cancelled() const {
+                    return group && group->_cancelled;
+                }
+
+                F func;
+                std::shared_ptr<DispatchGroup> group;
+            };
+
+            std::function<void()> _end_action;
+            std::vector<Task> _jobs;
+            std::mutex _mutex_jobs;
+            std::mutex _mutex_done;
+            std::condition_variable _cv_done;
+            std::vector<Task> _on_finish;
+            std::atomic<bool> _closed;
+            std::atomic<bool> _has_finished;
+            std::atomic<bool> _cancelled;
+            std::atomic<int> _pending_c;
+            Semaphore _sem_sync;
+
+            /**
+            *   The last signal runs the end action,
+            *   than wakes the waiters: the flag is
+            *   set under the lock, so no wakeup
+            *   is lost.
+            */
+            void
+            _signal_end_of_job() { 
+                if (--_pending_c != 0) return;
+                struct Finisher {
+                    DispatchGroup *g;
+                    ~Finisher() {
+                        std::unique_lock<std::mutex> lock(g->_mutex_done);
+                        g->_has_finished = true;
+                        g->_cv_done.notify_all();
+                        std::vector<Task> c(std::move(g->_on_finish));
+                        lock.unlock();
+                        for (auto &t : c) t();
+                    }
+                } finisher{this};
+                if (_end_action) _end_action();
+            }
+        };
+
+        /**
+        *   Thread safe class that manage
+        *   the waiting of the pool threads
+        *   when the queue is empty.
+        *   It works as an eventcount: a thread
+        *   registers itself with thread_wait(),
+        *   checks again for work, and only then
+        *   sleeps on its own semaphore, so each
+        *   pushed job wakes one thread only. A
+        *   thread that spins looking for work
+        *   can be claimed by a push instead of
+        *   waking a sleeping one.
+        */
+        class ThreadsBlocker
+        {
+        public:
+            ThreadsBlocker() {};
+            ~ThreadsBlocker() {};
+
+            void
+            activate_barrier() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _barrier = true;
+            }
+
+            void
+            deactivate_barrier() {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _barrier = false;
+            }
+
+            bool
+            thread_wait(Semaphore *rsem) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_barrier) return false;
+                _sems.push_back(rsem);
+                ++_waiting_c;
+                return true;
+            }
+
+            /**
+            *   Undo a thread_wait() for a thread that
+            *   found some work before going to sleep,
+            *   or that is leaving the pool.
+            */
+            void
+            cancel_wait(Semaphore *rsem) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = std::remove(_sems.begin(), _sems.end(), rsem);
+                _waiting_c -= static_cast<int>(_sems.end() - it);
+                _sems.erase(it, _sems.end());
+            }
+
+            /**
+            *   Number of threads currently registered
+            *   as waiting. Lock free, so it can be
+            *   read on the push path.
+            */
+            int
+            waiting() const {
+                return _waiting_c;
+            }
+
+            /**
+            *   A thread starts and stops spinning.
+            *   spin_end() returns false if a push 
+            *   has claimed the thread meanwhile.
+            */
+            void
+            spin_begin() {
+                ++_spinning_c;
+            }
+
+            bool
+            spin_end() {
+                auto s = _spinning_c.load();
+                while (s > 0 && !_spinning_c.compare_exchange_weak(s, s - 1)) {}
+                return s > 0;
+            }
+
+            void
+            unblock(bool also_activate_barrier = false) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (also_activate_barrier) {
+                    _barrier = true;
+                }
+                for (auto &s : _sems) {
+                    s->signal();
+                }
+                _sems.clear();
+                _waiting_c = 0;
+            }
+
+            /**
+            *   Find a thread for each of n new jobs:
+            *   first claim the spinning threads, then
+            *   wake the waiting ones, the last that 
+            *   went to sleep first [their caches are
+            *   the warmest]. Called after the jobs
+            *   are visible to the threads.
+            */
+            void
+            unblock_n(size_t n) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto s = _spinning_c.load();
+                while (n != 0 && s > 0) {
+                    if (_spinning_c.compare_exchange_weak(s, s - 1)) --n;
+                }
+                if (n == 0 || _waiting_c == 0) return;
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (n != 0 && !_sems.empty()) {
+                    _sems.back()->signal();
+                    _sems.pop_back();
+                    --_waiting_c;
+                    --n;
+                }
+            }
+
+        private:
+            std::vector<Semaphore*> _sems;
+            std::atomic<int> _waiting_c{0};
+            std::atomic<int> _spinning_c{0};
+            bool _barrier = false;
+            std::mutex _mutex;
+        };
+
+        /**
+        *   Chase-Lev work stealing deque, in the
+        *   weak memory model formulation of
+        *   Le, Pop, Cohen and Zappa Nardelli.
+        *   Only the owner thread calls push() and
+        *   pop(), which work on the bottom end;
+        *   any other thread can steal() from the top.
+        *   The deque owns the jobs it stores: the
+        *   slots hold pointers, so a losing stealer
+        *   never touches a non trivial object.
+        */
+        class WorkStealingDeque
+        {
+        public:
+            typedef Task Job;
+
+            WorkStealingDeque(std::int64_t capacity = 256) : 
+                _top(0),
+                _bottom(0),
+                _array(new Array(capacity)) 
+            {
+                _garbage.emplace_back(_array.load(std::memory_order_relaxed));
+            };
+            WorkStealingDeque(const WorkStealingDeque&) = delete;
+            WorkStealingDeque& operator = (const WorkStealingDeque&) = delete;
+
+            ~WorkStealingDeque() {
+                while (auto j = pop()) _delete_node(j);
+            };
+
+            void
+            push(Job *job) {
+                auto b = _bottom.load(std::memory_order_relaxed);
+                auto t = _top.load(std::memory_order_acquire);
+                auto a = _array.load(std::memory_order_relaxed);
+                if (b - t > a->capacity - 1) {
+                    a = a->grow(b, t);
+                    _garbage.emplace_back(a);
+                    _array.store(a, std::memory_order_release);
+                }
+                a->put(b, job);
+                std::atomic_thread_fence(std::memory_order_release);
+                _bottom.store(b + 1, std::memory_order_relaxed);
+            }
+
+            Job*
+            pop() {
+                auto b = _bottom.load(std::memory_order_relaxed) - 1;
+                auto a = _array.load(std::memory_order_relaxed);
+                _bottom.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto t = _top.load(std::memory_order_relaxed);
+                if (t > b) {
+                    _bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                auto job = a->get(b);
+                if (t == b) {
+                    if (!_top.compare_exchange_strong(t, t + 1, 
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        job = nullptr;
+                    }
+                    _bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return job;
+            }
+
+            Job*
+            steal() {
+                auto t = _top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto b = _bottom.load(std::memory_order_acquire);
+                if (t >= b) return nullptr;
+                auto job = _array.load(std::memory_order_acquire)->get(t);
+                if (!_top.compare_exchange_strong(t, t + 1, 
+                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    return nullptr;
+                }
+                return job;
+            }
+
+            /**
+            *   Approximated, the value can be stale
+            *   as soon as it is returned.
+            */
+            bool
+            empty() const {
+                return _bottom.load(std::memory_order_relaxed) <= 
+                    _top.load(std::memory_order_relaxed);
+            }
+
+        private:
+            /**
+            *   Circular buffer with a power of two
+            *   capacity. When full, the owner copies 
+            *   it in a buffer with double capacity; the old
+            *   one is kept alive until the deque is destroyed
+            *   because a stealer can still be reading it.
+            */
+            struct Array
+            {
+                Array(std::int64_t c) : 
+                    capacity(c), 
+                    slots(new std::atomic<Job*>[c]) {};
+
+                Job*
+                get(std::int64_t i) const {
+                    return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+                }
+
+                void
+                put(std::int64_t i, Job *job) {
+                    slots[i & (capacity - 1)].store(job, std::memory_order_relaxed);
+                }
+
+                Array*
+                grow(std::int64_t b, std::int64_t t) const {
+                    auto a = new Array(capacity * 2);
+                    for (auto i = t; i != b; ++i) a->put(i, get(i));
+                    return a;
+                }
+
+                const std::int64_t capacity;
+                std::unique_ptr<std::atomic<Job*>[]> slots;
+            };
+
+            std::atomic<std::int64_t> _top;
+            char _pad_top[TP_CACHE_LINE_SIZE];
+            std::atomic<std::int64_t> _bottom;
+            char _pad_bottom[TP_CACHE_LINE_SIZE];
+            std::atomic<Array*> _array;
+            std::vector<std::unique_ptr<Array> > _garbage;
+        };
+
+        /**
+        *   Bounded multi producer multi consumer
+        *   queue by Dmitry Vyukov. Every slot carries
+        *   a sequence number that tells producers and 
+        *   consumers whose turn it is, so the only 
+        *   shared writes are one CAS on the head or 
+        *   on the tail, each on its own cache line.
+        */
+        class RingBuffer
+        {
+        public:
+            typedef Task Job;
+
+            /**
+            *   The capacity is rounded up to
+            *   the next power of two.
+            */
+            RingBuffer(size_t capacity) :
+                _mask(_round_capacity(capacity) - 1),
+                _cells(new Cell[_mask + 1]),
+                _enqueue_pos(0),
+                _dequeue_pos(0) 
+            {
+                for (size_t i = 0; i <= _mask; ++i) {
+                    _cells[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            };
+            RingBuffer(const RingBuffer&) = delete;
+            RingBuffer& operator = (const RingBuffer&) = delete;
+            ~RingBuffer() {};
+
+            /**
+            *   Return false, leaving the job
+            *   untouched, if the ring is full.
+            */
+            template<class F> bool
+            try_push(F&& job) {
+                Cell *cell;
+                auto pos = _enqueue_pos.load(std::memory_order_relaxed);
+                for (;;) {
+                    cell = &_cells[pos & _mask];
+                    auto seq = cell->sequence.load(std::memory_order_acquire);
+                    auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                    if (dif == 0) {
+                        if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, 
+                            std::memory_order_relaxed)) break;
+                    } else if (dif < 0) {
+                        return false;
+                    } else {
+                        pos = _enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+                cell->job = std::forward<F>(job);
+                _stamp(cell->job);
+                cell->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool
+            try_pop(Job &job) {
+                Cell *cell;
+                auto pos = _dequeue_pos.load(std::memory_order_relaxed);
+                for (;;) {
+                    cell = &_cells[pos & _mask];
+                    auto seq = cell->sequence.load(std::memory_order_acquire);
+                    auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+                    if (dif == 0) {
+                        if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, 
+                            std::memory_order_relaxed)) break;
+                    } else if (dif < 0) {
+                        return false;
+                    } else {
+                        pos = _dequeue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+                job = std::move(cell->job);
+                cell->job = nullptr;
+                cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+            *   Approximated, the value can be stale
+            *   as soon as it is returned.
+            */
+            bool
+            empty() const {
+                return _enqueue_pos.load(std::memory_order_relaxed) == 
+                    _dequeue_pos.load(std::memory_order_relaxed);
+            }
+
+            size_t
+            capacity() const {
+                return _mask + 1;
+            }
+
+            size_t
+            bytes() const {
+                return capacity() * sizeof(Cell);
+            }
+
+        private:
+            struct Cell
+            {
+                std::atomic<size_t> sequence;
+                Job job;
+            };
+
+            static size_t
+            _round_capacity(size_t capacity) {
+                size_t c = 2;
+                while (c < capacity) c <<= 1;
+                return c;
+            }
+
+            char _pad_begin[TP_CACHE_LINE_SIZE];
+            const size_t _mask;
+            std::unique_ptr<Cell[]> _cells;
+            char _pad_cells[TP_CACHE_LINE_SIZE];
+            std::atomic<size_t> _enqueue_pos;
+            char _pad_enqueue[TP_CACHE_LINE_SIZE];
+            std::atomic<size_t> _dequeue_pos;
+            char _pad_dequeue[TP_CACHE_LINE_SIZE];
+        };
+
+        /**
+        *   Queue with one FIFO level for each
+        *   Priority, served from the highest.
+        *   Aging: a waiting level that has been 
+        *   skipped TP_PRIORITY_AGING times is 
+        *   served next, so no level starves.
+        *   Not thread safe, guarded by _mutex_queue.
+        */
+        class PriorityQueue
+        {
+        public:
+            static const int levels = 4;
+
+            PriorityQueue() : _size(0) {
+                for (int l = 0; l < levels; ++l) _skipped[l] = 0;
+            };
+            PriorityQueue(const PriorityQueue&) = delete;
+            PriorityQueue& operator = (const PriorityQueue&) = delete;
+            ~PriorityQueue() {};
+
+            template<class F> void
+            emplace_back(F&& t, Priority p) {
+                _levels[static_cast<int>(p)].emplace_back(std::forward<F>(t));
+                _stamp(_levels[static_cast<int>(p)].back(), p);
+                ++_size;
+            }
+
+            template<class F> void
+            emplace_front(F&& t, Priority p) {
+                _levels[static_cast<int>(p)].emplace_front(std::forward<F>(t));
+                _stamp(_levels[static_cast<int>(p)].front(), p);
+                ++_size;
+            }
+
+            /**
+            *   Pop the next job and store its level
+            *   in *p*. Return an empty Task if
+            *   the queue is empty.
+            */
+            Task
+            pop(Priority &p) {
+                if (_size == 0) return Task();
+                int top = levels - 1;
+                while (_levels[top].empty()) --top;
+                int served = top;
+                for (int l = top - 1; l >= 0; --l) {
+                    if (_levels[l].empty()) continue;
+                    if (++_skipped[l] >= TP_PRIORITY_AGING && served == top) served = l;
+                }
+                _skipped[served] = 0;
+                p = static_cast<Priority>(served);
+                auto t = std::move(_levels[served].front());
+                _levels[served].pop_front();
+                --_size;
+                return t;
+            }
+
+            /**
+            *   Pop the oldest droppable job of the
+            *   lowest level below *below* that has
+            *   one, an empty Task if there is none.
+            */
+            Task
+            pop_droppable(Priority &p, int below) {
+                for (int l = 0; l < below && l < levels; ++l) {
+                    auto &level = _levels[l];
+                    for (auto it = level.begin(); it != level.end(); ++it) {
+                        if (!it->droppable) continue;
+                        auto t = std::move(*it);
+                        level.erase(it);
+                        --_size;
+                        p = static_cast<Priority>(l);
+                        return t;
+                    }
+                }
+                return Task();
+            }
+
+            bool
+            empty() const {
+                return _size == 0;
+            }
+
+            size_t
+            size() const {
+                return _size;
+            }
+
+        private:
+            std::deque<Task, PoolAllocator<Task> > _levels[levels];
+            int _skipped[levels];
+            size_t _size;
+        };
+
+        /**
+        *   Hierarchical timer wheel of *levels* 
+        *   levels of 64 slots, a slot of level L
+        *   spans 64^L ticks. A timer is linked in
+        *   the lowest level where its deadline has
+        *   the same higher bits of the current tick,
+        *   and moves down when the current tick 
+        *   enters its slot. The timers live in a
+        *   vector, linked in their slot by index, so
+        *   insert and cancel are O(1); a bitmap for
+        *   each level finds the next busy slot.
+        *   Not thread safe, guarded by _mutex_timers.
+        */
+        class TimerWheel
+        {
+        public:
+            static const int levels = 6;
+            static const std::uint64_t never = ~0ull;
+
+            TimerWheel() : _now(0), _size(0), _free(_none) {
+                for (auto &h : _heads) h = _none;
+                for (auto &b : _busy) b = 0;
+            };
+            TimerWheel(const TimerWheel&) = delete;
+            TimerWheel& operator = (const TimerWheel&) = delete;
+            ~TimerWheel() {};
+
+            /**
+            *   Add a timer for tick *at* running *job*,
+            *   or *every* each *period* ticks if the 
+            *   period is not zero.
+            */
+            TimerId
+            insert(std::uint64_t at, std::uint64_t period, Task job, 
+                std::function<void()> every) {
+                std::uint32_t i = _free;
+                if (i != _none) _free = _nodes[i].next;
+                else {
+                    i = static_cast<std::uint32_t>(_nodes.size());
+                    _nodes.emplace_back();
+                }
+                Node &n = _nodes[i];
+                n.deadline = at;
+                n.period = period;
+                n.job = std::move(job);
+                n.every = std::move(every);
+                _link(i);
+                ++_size;
+                return (static_cast<TimerId>(n.gen) << 32) | i;
+            }
+
+            /**
+            *   Remove a pending timer. Return false
+            *   if it already fired or was cancelled.
+            */
+            bool
+            cancel(TimerId id) {
+                auto i = static_cast<std::uint32_t>(id);
+                if (i >= _nodes.size() || _nodes[i].gen != (id >> 32) || _nodes[i].slot < 0) {
+                    return false;
+                }
+                _unlink(i);
+                _release(i);
+                return true;
+            }
+
+            /**
+            *   Move the wheel to tick *now*, appending
+            *   the jobs of the expired timers to *out*.
+            *   The periodic ones are linked again for
+            *   their next period, skipping the missed
+            *   ones.
+            */
+            void
+            advance(std::uint64_t now, std::vector<Task> &out) {
+                for (auto e = next(); e <= now; e = next()) {
+                    _now = e;
+                    for (int l = levels; l > 0; --l) {
+                        if (_now & ((1ull << (_bits * l)) - 1)) continue;
+                        auto i = _detach(_slot(l, _now));
+                        while (i != _none) {
+                            auto n = _nodes[i].next;
+                            _link(i);
+                            i = n;
+                        }
+                    }
+                    auto i = _detach(_slot(0, _now));
+                    while (i != _none) {
+                        Node &t = _nodes[i];
+                        auto n = t.next;
+                        if (t.period != 0) {
+                            out.emplace_back(t.every);
+                            t.deadline += t.period;
+                            if (t.deadline <= _now) {
+                                t.deadline += ((_now - t.deadline) / t.period + 1) * t.period;
+                            }
+                            _link(i);
+                        } else {
+                            out.push_back(std::move(t.job));
+                            _release(i);
+                        }
+                        i = n;
+                    }
+                }
+                if (now > _now) _now = now;
+            }
+
+            /**
+            *   First tick at which advance has 
+            *   something to do, never if empty.
+            */
+            std::uint64_t
+            next() const {
+                if (_size == 0) return never;
+                std::uint64_t best = never;
+                for (int l = 0; l < levels; ++l) {
+                    int shift = _bits * l;
+                    int cur = static_cast<int>((_now >> shift) & 63);
+                    auto busy = _busy[l] & (l == 0 ? ~0ull << cur : ~1ull << cur);
+                    if (!busy) continue;
+                    auto base = (_now >> (shift + _bits)) << (shift + _bits);
+                    best = std::min(best, base | (static_cast<std::uint64_t>(_lowest(busy)) << shift));
+                }
+                if (_heads[levels << _bits] != _none) {
+                    best = std::min(best, ((_now >> (_bits * levels)) + 1) << (_bits * levels));
+                }
+                return best;
+            }
+
+            size_t
+            size() const {
+                return _size;
+            }
+
+        private:
+            static const int _bits = 6;
+            static const std::uint32_t _none = 0xffffffff;
+
+            struct Node
+            {
+                Node() : deadline(0), period(0), prev(_none), next(_none), gen(1), slot(-1) {};
+
+                Task job;
+                std::function<void()> every;
+                std::uint64_t deadline;
+                std::uint64_t period;
+                std::uint32_t prev;
+                std::uint32_t next;
+                std::uint32_t gen;
+                /** 
+                *   level * 64 + slot, levels * 64 for
+                *   the overflow list, -1 when free. 
+                */
+                int slot;
+            };
+
+            static int
+            _lowest(std::uint64_t b) {
+                #if defined(__GNUC__) || defined(__clang__)
+                return __builtin_ctzll(b);
+                #else
+                int i = 0;
+                while (!(b & 1)) { b >>= 1; ++i; }
+                return i;
+                #endif
+            }
+
+            static int
+            _slot(int level, std::uint64_t tick) {
+                if (level == levels) return levels << _bits;
+                return (level << _bits) | static_cast<int>((tick >> (_bits * level)) & 63);
+            }
+
+            void
+            _link(std::uint32_t i) {
+                Node &n = _nodes[i];
+                auto at = std::max(n.deadline, _now);
+                auto diff = at ^ _now;
+                int level = 0;
+                while (level < levels && (diff >> (_bits * (level + 1))) != 0) ++level;
+                n.slot = _slot(level, at);
+                n.prev = _none;
+                n.next = _heads[n.slot];
+                if (n.next != _none) _nodes[n.next].prev = i;
+                _heads[n.slot] = i;
+                if (level < levels) _busy[level] |= 1ull << (n.slot & 63);
+            }
+
+            void
+            _unlink(std::uint32_t i) {
+                Node &n = _nodes[i];
+                if (n.prev != _none) _nodes[n.prev].next = n.next;
+                else _heads[n.slot] = n.next;
+                if (n.next != _none) _nodes[n.next].prev = n.prev;
+                if (_heads[n.slot] == _none && n.slot < (levels << _bits)) {
+                    _busy[n.slot >> _bits] &= ~(1ull << (n.slot & 63));
+                }
+            }
+
+            /**
+            *   Empty a slot, returning the head
+            *   of its list.
+            */
+            std::uint32_t
+            _detach(int slot) {
+                auto i = _heads[slot];
+                _heads[slot] = _none;
+                if (slot < (levels << _bits)) _busy[slot >> _bits] &= ~(1ull << (slot & 63));
+                return i;
+            }
+
+            void
+            _release(std::uint32_t i) {
+                Node &n = _nodes[i];
+                n.job = nullptr;
+                n.every = nullptr;
+                n.slot = -1;
+                ++n.gen;
+                n.next = _free;
+                _free = i;
+                --_size;
+            }
+
+            std::vector<Node> _nodes;
+            std::uint32_t _heads[(levels << _bits) + 1];
+            std::uint64_t _busy[levels];
+            std::uint64_t _now;
+            size_t _size;
+            std::uint32_t _free;
+        };
+
+        #if TP_ENABLE_METRICS
+        /**
+        *   Metrics slot of a worker, written only by 
+        *   its thread with relaxed stores and read by
+        *   stats(). Padded on both sides so that the
+        *   slots never share a line with anything.
+        */
+        struct WorkerMetrics
+        {
+            WorkerMetrics() {
+                for (int i = 0; i < TP_METRICS_BUCKETS; ++i) {
+                    wait[i].store(0, std::memory_order_relaxed);
+                    run[i].store(0, std::memory_order_relaxed);
+                }
+            }
+
+            static void
+            add(std::atomic<std::uint64_t> &c, std::uint64_t v) {
+                c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+            }
+
+            char _pad_begin[TP_CACHE_LINE_SIZE];
+            std::atomic<std::uint64_t> stolen{0};
+            std::atomic<std::uint64_t> parks{0};
+            std::atomic<std::uint64_t> idle_ns{0};
+            std::atomic<std::uint64_t> park_ns{0};
+            std::atomic<std::uint64_t> depth_max{0};
+            std::atomic<std::uint64_t> wait[TP_METRICS_BUCKETS];
+            std::atomic<std::uint64_t> run[TP_METRICS_BUCKETS];
+            /**
+            *   Start of the current idle period,
+            *   0 while running jobs. Owner only.
+            */
+            std::uint64_t idle_since = 0;
+            char _pad_end[TP_CACHE_LINE_SIZE];
+        };
+        #endif
+
+        #if TP_ENABLE_TRACING
+        /**
+        *   Events of the trace. Task: ts and dur of
+        *   the run, aux the enqueue time, id the flow
+        *   id, tag the group << 8 | the priority.
+        *   Park: ts and dur of the sleep. Group
+        *   events: aux the address of the group.
+        */
+        enum class TraceKind
+        {
+            Task,
+            Park,
+            Steal,
+            GroupOpen,
+            GroupClose,
+            GroupFinish
+        };
+
+        struct TraceRecord
+        {
+            TraceKind kind;
+            std::uint32_t tid;
+            std::uint64_t ts;
+            std::uint64_t dur;
+            std::uint64_t aux;
+            std::uint64_t id;
+            std::uint64_t tag;
+            const char *label;
+            std::string group;
+        };
+
+        /**
+        *   Events of a pool thread, written without 
+        *   locks by that thread only, the oldest
+        *   overwritten. The writer announces a slot
+        *   in _begun before filling it and publishes
+        *   it in _done: a reader discards the slots
+        *   that may have been rewritten meanwhile.
+        */
+        class TraceRing
+        {
+        public:
+            TraceRing() : _begun(0), _done(0) {};
+
+            void
+            write(TraceKind kind, std::uint32_t tid, std::uint64_t ts, std::uint64_t dur,
+                std::uint64_t aux, std::uint64_t id, std::uint64_t tag, const char *label) {
+                auto h = _done.load(std::memory_order_relaxed);
+                _begun.store(h + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                auto &e = _slots[h & (TP_TRACE_BUFFER_SIZE - 1)];
+                e.kind.store(static_cast<int>(kind), std::memory_order_relaxed);
+                e.tid.store(tid, std::memory_order_relaxed);
+                e.ts.store(ts, std::memory_order_relaxed);
+                e.dur.store(dur, std::memory_order_relaxed);
+                e.aux.store(aux, std::memory_order_relaxed);
+                e.id.store(id, std::memory_order_relaxed);
+                e.tag.store(tag, std::memory_order_relaxed);
+                e.label.store(label, std::memory_order_relaxed);
+                _done.store(h + 1, std::memory_order_release);
+            }
+
+            void
+            read(std::vector<TraceRecord> &out) const {
+                auto h = _done.load(std::memory_order_acquire);
+                auto b = h > TP_TRACE_BUFFER_SIZE ? h - TP_TRACE_BUFFER_SIZE : 0;
+                auto first = out.size();
+                for (auto i = b; i < h; ++i) {
+                    auto &e = _slots[i & (TP_TRACE_BUFFER_SIZE - 1)];
+                    TraceRecord r;
+                    r.kind = static_cast<TraceKind>(e.kind.load(std::memory_order_relaxed));
+                    r.tid = e.tid.load(std::memory_order_relaxed);
+                    r.ts = e.ts.load(std::memory_order_relaxed);
+                    r.dur = e.dur.load(std::memory_order_relaxed);
+                    r.aux = e.aux.load(std::memory_order_relaxed);
+                    r.id = e.id.load(std::memory_order_relaxed);
+                    r.tag = e.tag.load(std::memory_order_relaxed);
+                    r.label = e.label.load(std::memory_order_relaxed);
+                    out.push_back(std::move(r));
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                auto g = _begun.load(std::memory_order_relaxed);
+                if (g > b + TP_TRACE_BUFFER_SIZE) {
+                    auto torn = std::min<std::uint64_t>(g - TP_TRACE_BUFFER_SIZE - b, h - b);
+                    out.erase(out.begin() + first, out.begin() + first + torn);
+                }
+            }
+
+        private:
+            struct Slot
+            {
+                std::atomic<int> kind{0};
+                std::atomic<std::uint32_t> tid{0};
+                std::atomic<std::uint64_t> ts{0};
+                std::atomic<std::uint64_t> dur{0};
+                std::atomic<std::uint64_t> aux{0};
+                std::atomic<std::uint64_t> id{0};
+                std::atomic<std::uint64_t> tag{0};
+                std::atomic<const char*> label{nullptr};
+            };
+
+            static_assert((TP_TRACE_BUFFER_SIZE & (TP_TRACE_BUFFER_SIZE - 1)) == 0,
+                "TP_TRACE_BUFFER_SIZE must be a power of two");
+
+            std::atomic<std::uint64_t> _begun;
+            char _pad[TP_CACHE_LINE_SIZE];
+            std::atomic<std::uint64_t> _done;
+            Slot _slots[TP_TRACE_BUFFER_SIZE];
+        };
+
+        /**
+        *   Trace state of a pool, shared with the
+        *   finish actions of the groups that may 
+        *   run after the pool is gone. The rings
+        *   of the threads that left are recycled 
+        *   by the new ones. The events of other
+        *   threads [groups] go in external.
+        */
+        struct Tracer
+        {
+            std::atomic<bool> on{false};
+            std::uint64_t since = 0;
+            std::uint32_t pid = 0;
+            std::mutex mutex;
+            std::vector<std::unique_ptr<TraceRing> > rings;
+            std::vector<TraceRing*> free_rings;
+            std::deque<TraceRecord> external;
+
+            TraceRing*
+            acquire() {
+                if (free_rings.empty()) {
+                    rings.emplace_back(new TraceRing());
+                    return rings.back().get();
+                }
+                auto r = free_rings.back();
+                free_rings.pop_back();
+                return r;
+            }
+
+            void
+            group(TraceKind kind, const std::string &id, const void *handle) {
+                if (!on.load(std::memory_order_relaxed)) return;
+                TraceRecord r;
+                r.kind = kind;
+                r.tid = _trace_tid();
+                r.ts = _now_ns();
+                r.dur = 0;
+                r.aux = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(handle));
+                r.id = 0;
+                r.tag = 0;
+                r.label = nullptr;
+                r.group = id;
+                std::unique_lock<std::mutex> lock(mutex);
+                if (external.size() == TP_TRACE_BUFFER_SIZE) external.pop_front();
+                external.push_back(std::move(r));
+            }
+        };
+        #endif
+
+        /**
+        *   State owned by each thread of the pool.
+        *   Shared pointers to the workers are kept by
+        *   the pool and by the stealers' snapshots, so
+        *   a worker outlives its thread as long as 
+        *   someone can still steal from it.
+        */
+        struct Worker
+        {
+            WorkStealingDeque deque;
+            std::vector<std::shared_ptr<Worker> > victims;
+            int victims_version = -1;
+            std::uint32_t seed = 0x9E3779B9u;
+            /**
+            *   The thread of the worker, joined once
+            *   it has exited [_mutex_pool], and the
+            *   semaphore it sleeps on.
+            */
+            std::thread thread;
+            Semaphore sem{0};
+            /**
+            *   Set by the pool to make the worker leave
+            *   its loop, and by the worker when it does
+            *   not touch the pool anymore.
+            */
+            std::atomic<bool> retire{false};
+            std::atomic<bool> exited{false};
+            /**
+            *   NUMA node whose queue the worker 
+            *   serves first.
+            */
+            std::atomic<int> node{0};
+            /**
+            *   Current spin length: doubled when a
+            *   spin finds work, halved when it does
+            *   not. Negative until the first spin.
+            */
+            int spin = -1;
+            /**
+            *   Load seen by the autoscaler: whether a
+            *   job is running, and the jobs run so 
+            *   far. Written only by the worker.
+            */
+            std::atomic<bool> busy{false};
+            std::atomic<std::uint64_t> done{0};
+            #if TP_ENABLE_METRICS
+            WorkerMetrics metrics;
+            #endif
+            #if TP_ENABLE_TRACING
+            /**
+            *   Ring the worker traces into, null
+            *   while tracing has never been on.
+            */
+            std::atomic<TraceRing*> trace{nullptr};
+            #endif
+
+            /**
+            *   Xorshift, used to pick the first victim.
+            */
+            std::uint32_t
+            next_random() {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                return seed;
+            }
+        };
+
+        /**
+        *   Jobs pushed with a NUMA node hint, one
+        *   queue for each node of the machine.
+        */
+        struct NodeQueue
+        {
+            std::mutex mutex;
+            std::deque<Task, PoolAllocator<Task> > jobs;
+            char _pad[TP_CACHE_LINE_SIZE];
+        };
+
+        /**
+        *   Identifies the pool and the worker
+        *   which the calling thread belongs to.
+        */
+        struct ThreadContext
+        {
+            ThreadPool *pool;
+            Worker *worker;
+            int help_depth;
+        };
+
+        /**
+        *   Job that computes the value of a 
+        *   future. If it is destroyed without
+        *   running, the future gets a 
+        *   broken_promise error.
+        */
+        template<class F, class R> struct FutureJob
+        {
+            FutureJob(F&& f, std::shared_ptr<FutureState<R> > s) : 
+                func(std::move(f)), state(std::move(s)) {};
+            FutureJob(const F& f, std::shared_ptr<FutureState<R> > s) : 
+                func(f), state(std::move(s)) {};
+            FutureJob(FutureJob&& J) noexcept : 
+                func(std::move(J.func)), state(std::move(J.state)) {};
+            FutureJob(const FutureJob&) = delete;
+            ~FutureJob() {
+                if (state) state->set_exception(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+            }
+
+            void
+            operator()() {
+                std::shared_ptr<FutureState<R> > s(std::move(state));
+                if (!s->start()) return;
+                try {
+                    FutureFulfill<R>::run(*s, func);
+                } catch(...) {
+                    s->set_exception(std::current_exception());
+                }
+            }
+
+            bool
+            cancelled() const {
+                return state && state->cancelled();
+            }
+
+            F func;
+            std::shared_ptr<FutureState<R> > state;
+        };
+
+        /**
+        *   Job pushed with a CancellationToken:
+        *   skipped once the token is cancelled.
+        */
+        template<class F> struct CancellableJob
+        {
+            CancellableJob(F&& f, const CancellationToken &t) : 
+                func(std::move(f)), token(t) {};
+            CancellableJob(const F& f, const CancellationToken &t) : 
+                func(f), token(t) {};
+
+            void
+            operator()() {
+                if (!token.is_cancelled()) func();
+            }
+
+            bool
+            cancelled() const {
+                return token.is_cancelled();
+            }
+
+            F func;
+            CancellationToken token;
+        };
+
+        /**
+        *   Job that runs a node of a graph, than
+        *   pushes the successors that became ready.
+        *   The last ready successor is run by the
+        *   same job, without a trip in the queue.
+        */
+        struct GraphJob
+        {
+            GraphJob(ThreadPool *p, TaskGraph *g, TaskGraph::Node *n) : 
+                pool(p), graph(g), node(n) {};
+
+            void
+            operator()() {
+                TaskGraph::Node *n = node;
+                while (n) {
+                    graph->_run_node(*n);
+                    TaskGraph::Node *next = nullptr;
+                    for (auto s : n->successors) {
+                        if (--s->pending != 0) continue;
+                        if (next) pool->_safe_queue_push(Task(GraphJob(pool, graph, next)));
+                        next = s;
+                    }
+                    graph->_node_done();
+                    n = next;
+                }
+            }
+
+            ThreadPool *pool;
+            TaskGraph *graph;
+            TaskGraph::Node *node;
+        };
+
+        /**
+        *       _    ____ ___ 
+        *      / \  |  _ \_ _|
+        *     / _ \ | |_) | | 
+        *    / ___ \|  __/| | 
+        *   /_/   \_\_|  |___|
+        *
+        */
+    public:
+        /**
+        *   Lightweight reference to a dispatch
+        *   group, returned by dg_open().
+        */
+        typedef std::shared_ptr<DispatchGroup> DispatchGroupHandle;
+
+        /**
+        *   If *max_threads* is not specified,
+        *   the pool size is set to the max number
+        *   of threads supported by the architecture.
+        *   At least one thread is created.
+        *   The *mode* selects how the jobs are queued,
+        *   and cannot be changed later; *ring_capacity*
+        *   is used only by QueueMode::RingBuffer.
+        */
+        ThreadPool(int max_threads = std::thread::hardware_concurrency(),
+            QueueMode mode = QueueMode::Global,
+            size_t ring_capacity = 4096) 
+        noexcept(false) : 
+            _mode(mode),
+            _ring(mode == QueueMode::RingBuffer ? new RingBuffer(ring_capacity) : nullptr),
+            _sem_api(Semaphore(1)),
+            _sem_job_ins_container(Semaphore(1)),
+            _thread_sleep_time_ns(1000),
+            _spin_budget(std::thread::hardware_concurrency() > 1 ? TP_SPIN_BUDGET : 0),
+            _run_pool_thread(true),
+            _queue_c(0),
+            _queue_urgent_c(0),
+            _node_c(0),
+            _workers_version(0),
+            _threads_count(0),
+            _push_c(0),
+            _prev_threads(0)
+        {
+            #if TP_ENABLE_DEFAULT_EXCEPTION_CALL
+            _exception_action = [](std::exception_ptr e) {};
+            #endif
+
+            for (size_t i = 0; i < _topology().size(); ++i) {
+                _node_queues.emplace_back(new NodeQueue());
+            }
+
+            #if TP_ENABLE_TRACING
+            _tracer = std::make_shared<Tracer>();
+            _tracer->pid = _trace_new_pid();
+            #endif
+
+            #if TP_ENABLE_SANITY_CHECKS
+            try {
+                resize(max_threads);
+            } catch(std::runtime_error e) {
+                throw e;
+            }
+            #else
+                resize(max_threads);
+            #endif
+        }; 
+
+        /**
+        *   Copy constructor.
+        */ 
+        ThreadPool(const ThreadPool &TP) = delete;
+        
+        /**
+        *   Deleted assignment operators
+        */
+        ThreadPool& operator = (ThreadPool&& TP) = delete;
+        ThreadPool& operator = (const ThreadPool& TP) = delete;
+    
+        /**
+        *   When the ThreadPool is deallocated,
+        *   every thread, also the ones retired by
+        *   a resize, finishes its job and is joined.
+        */
+        ~ThreadPool() noexcept {
+            try {
+                disable_autoscale();
+                _timers_shutdown();
+                std::unique_lock<std::mutex> lock(_mutex_pool);
+                while (!_pool.empty()) _unsafe_thread_pop();
+                lock.unlock();
+                _run_pool_thread = false;
+                _threads_blocker.unblock(true);
+                _join_retired();
+            } catch (...) {}
+        };
+
+        /**
+        *   Update size for the thread pool;
+        *   the abs value of num_threads is taken.
+        */
+        void
+        resize(int num_threads = std::thread::hardware_concurrency()) 
+        noexcept(false) {
+            if (!_run_pool_thread) return;
+            
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.resize_alloc, 
+                [&](){ return num_threads < 1; });
+            #endif
+
+            _sem_api.wait();
+            auto diff = abs(num_threads - _threads_count);
+            if (num_threads > _threads_count) {
+                for (auto i = 0; i < diff; ++i) _safe_thread_push();
+            } else {
+                for (auto i = 0; i < diff; ++i) _safe_thread_pop();
+            }
+            _sem_api.signal();
+        }
+
+        /**
+        *   Push a job to do in jobs queue.
+        *   Use lambda expressions in order to
+        *   load jobs.
+        */
+        template<class F> ThreadPool&
+        push(F&& f) {
+            _bounded_push(Task(std::forward<F>(f)));
+            return *this;
+        }
+
+        /**
+        *   Push a job named *label* in the trace, 
+        *   a plain push when tracing is compiled out.
+        */
+        template<class F> ThreadPool&
+        push(TraceLabel label, F&& f) {
+            Task t(std::forward<F>(f));
+            #if TP_ENABLE_TRACING
+            t.label = label.name;
+            #endif
+            (void)label;
+            _bounded_push(std::move(t));
+            return *this;
+        }
+
+        /**
+        *   Push a job that is dropped, without 
+        *   running, if *token* is cancelled before
+        *   it starts. wait() and queue_size() 
+        *   count it until it is dropped.
+        */
+        template<class F> ThreadPool&
+        push(CancellationToken token, F&& f) {
+            typedef typename std::decay<F>::type Fn;
+            _bounded_push(Task(CancellableJob<Fn>(std::forward<F>(f), token)));
+            return *this;
+        }
+
+        /**
+        *   Push a job with a priority: the pool
+        *   threads serve the higher levels first.
+        */
+        template<class F> ThreadPool&
+        push(Priority prio, F&& f) {
+            _bounded_push(Task(std::forward<F>(f)), prio);
+            return *this;
+        }
+
+        /**
+        *   Push a job for the threads of a NUMA 
+        *   node [modulo numa_nodes()]: they serve
+        *   it before the other Normal jobs, the 
+        *   threads of the other nodes only when 
+        *   they have nothing else to do.
+        */
+        template<class F> ThreadPool&
+        push_on_node(int node, F&& f) {
+            Task t(std::forward<F>(f));
+            if (_capacity.load(std::memory_order_relaxed) != 0 && !_admit(t)) return *this;
+            auto &q = *_node_queues[static_cast<size_t>(node < 0 ? -node : node) % 
+                _node_queues.size()];
+            ++_push_c;
+            {
+                std::unique_lock<std::mutex> lock(q.mutex);
+                q.jobs.push_back(std::move(t));
+                _stamp(q.jobs.back());
+                ++_node_c;
+            }
+            _threads_blocker.unblock_n(1);
+            return *this;
+        }
+
+        /**
+        *   Push *f* once *delay* has elapsed. The 
+        *   timer does not hold a thread: a timer
+        *   thread, started by the first timer, 
+        *   pushes the job when it expires, on the
+        *   first tick [TP_TIMER_TICK_US] after the
+        *   deadline. wait() does not wait for the
+        *   pending timers.
+        */
+        template<class Rep, class Period, class F> TimerId
+        push_after(const std::chrono::duration<Rep, Period> &delay, F&& f) {
+            return push_at(std::chrono::steady_clock::now() + delay, std::forward<F>(f));
+        }
+
+        /**
+        *   Push *f* at the time point *when*, of 
+        *   any clock.
+        */
+        template<class Clock, class Duration, class F> TimerId
+        push_at(const std::chrono::time_point<Clock, Duration> &when, F&& f) {
+            return _timer_insert(_timer_tick(when), 0, Task(std::forward<F>(f)), 
+                std::function<void()>());
+        }
+
+        /**
+        *   Push *f* every *period*, the first time
+        *   after one period, until cancel_timer. 
+        *   The rate is fixed: the periods missed 
+        *   while the pool was late are skipped, and
+        *   a run longer than the period overlaps
+        *   with the next one.
+        */
+        template<class Rep, class Period, class F> TimerId
+        push_every(const std::chrono::duration<Rep, Period> &period, F&& f) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.timer_period, [&](){ return period.count() <= 0; });
+            #endif
+            typedef typename std::decay<F>::type Fn;
+            auto fn = std::make_shared<Fn>(std::forward<F>(f));
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+            std::uint64_t ticks = std::max<std::int64_t>(1, 
+                (ns + TP_TIMER_TICK_US * 1000 - 1) / (TP_TIMER_TICK_US * 1000));
+            return _timer_insert(_timer_tick(std::chrono::steady_clock::now() + period), ticks, 
+                Task(), [fn]() { (*fn)(); });
+        }
+
+        /**
+        *   Cancel a pending timer. Return false if
+        *   it already fired [a periodic one never
+        *   does] or was cancelled; a job already
+        *   pushed by the timer still runs.
+        */
+        bool
+        cancel_timer(TimerId id) {
+            std::unique_lock<std::mutex> lock(_mutex_timers);
+            return _timers.cancel(id);
+        }
+
+        size_t
+        timers_pending() {
+            std::unique_lock<std::mutex> lock(_mutex_timers);
+            return _timers.size();
+        }
+
+        /**
+        *   Push a job to do in jobs queue.
+        *   Use lambda expressions in order to
+        *   load jobs. Overload operator <<.
+        */
+        template<class F> ThreadPool&
+        operator<<(F&& f) {
+            _bounded_push(Task(std::forward<F>(f)));
+            return *this;
+        } 
+
+        /**
+        *   Bound the jobs in the pool [queued or
+        *   running] to *capacity*, 0 for unbounded
+        *   [the default]. A push, push_bulk or 
+        *   future_from_push over the capacity 
+        *   applies *policy*; from a pool thread
+        *   Block pushes anyway, not to deadlock.
+        *   The jobs of dispatch groups, graphs, 
+        *   timers, continuations and coroutine
+        *   resumptions are neither bounded nor
+        *   dropped.
+        *   With concurrent producers the bound can
+        *   be exceeded by one job per producer.
+        */
+        void
+        set_capacity(size_t capacity, OverflowPolicy policy = OverflowPolicy::Block) {
+            _overflow.store(policy, std::memory_order_relaxed);
+            _capacity.store(static_cast<int>(std::min<size_t>(capacity, 
+                std::numeric_limits<int>::max())), std::memory_order_relaxed);
+            _space_ec.notify_all();
+        }
+
+        size_t
+        capacity() const {
+            return static_cast<size_t>(_capacity.load(std::memory_order_relaxed));
+        }
+
+        OverflowPolicy
+        overflow_policy() const {
+            return _overflow.load(std::memory_order_relaxed);
+        }
+
+        /**
+        *   Bytes of free task nodes kept for reuse
+        *   when the pool goes idle: a worker that 
+        *   finds no job to do hands its free nodes
+        *   back and, if the pool is empty, frees 
+        *   the ones above the reserve. The nodes
+        *   are shared by all the pools of the 
+        *   process [see NodePool].
+        */
+        void
+        set_memory_reserve(size_t bytes) {
+            _memory_reserve.store(bytes, std::memory_order_relaxed);
+        }
+
+        size_t
+        memory_reserve() const {
+            return _memory_reserve.load(std::memory_order_relaxed);
+        }
+
+        /**
+        *   Free the task nodes above the reserve
+        *   now, as the idle workers do.
+        */
+        void
+        trim_memory() {
+            NodePool::flush();
+            NodePool::trim(memory_reserve());
+        }
+
+        /**
+        *   Push a job only if the pool is below its
+        *   capacity, whatever the policy. Return 
+        *   false otherwise, leaving *f* untouched.
+        */
+        template<class F> bool
+        try_push(F&& f) {
+            if (!_reserve_slot()) return false;
+            _reserved_push(std::forward<F>(f));
+            return true;
+        }
+
+        /**
+        *   As try_push, waiting up to *timeout* for
+        *   the pool to go below its capacity.
+        */
+        template<class Rep, class Period, class F> bool
+        push_for(const std::chrono::duration<Rep, Period> &timeout, F&& f) {
+            auto until = std::chrono::steady_clock::now() + timeout;
+            while (!_reserve_slot()) {
+                if (std::chrono::steady_clock::now() >= until ||
+                    !_space_ec.wait_until([this]() { return _has_space(); }, until)) return false;
+            }
+            _reserved_push(std::forward<F>(f));
+            return true;
+        }
+
+        /**
+        *   Push multiple jobs to do in jobs queue.
+        *   Use lambda expressions in order to
+        *   load jobs.
+        */
+        template<class F, class G, class ...Args> ThreadPool&
+        push(F&& f, G&& g, Args&&... args) {
+            std::vector<Task> tasks;
+            tasks.reserve(2 + sizeof...(Args));
+            tasks.emplace_back(std::forward<F>(f));
+            tasks.emplace_back(std::forward<G>(g));
+            int expand[] = { 0, (tasks.emplace_back(std::forward<Args>(args)), 0)... };
+            (void)expand;
+            _bounded_push_bulk(tasks);
+            return *this;
+        }
+
+        /**
+        *   Push the jobs in [first, last), moving 
+        *   them out of the range. The queue is 
+        *   locked once and at most one sleeping
+        *   thread per job is woken up.
+        */
+        template<class It> ThreadPool&
+        push_bulk(It first, It last) {
+            std::vector<Task> tasks;
+            tasks.reserve(static_cast<size_t>(std::distance(first, last)));
+            for (; first != last; ++first) tasks.emplace_back(std::move(*first));
+            _bounded_push_bulk(tasks);
+            return *this;
+        }
+
+        /**
+        *   Push n jobs made by gen(i), for i in
+        *   [0, n). As push_bulk, gen is called
+        *   before the queue is locked.
+        */
+        template<class G> ThreadPool&
+        push_n(size_t n, G&& gen) {
+            std::vector<Task> tasks;
+            tasks.reserve(n);
+            for (size_t i = 0; i < n; ++i) tasks.emplace_back(gen(i));
+            _bounded_push_bulk(tasks);
+            return *this;
+        }
+
+        /**
+        *   Insert and execute a task for a
+        *   count number of times, and wait until
+        *   execution is done.
+        */
+        template<class F> void
+        apply_for(const int count, F&& f) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.apply_it_num, 
+                [&](){ return count < 0; });
+            #endif
+
+            #if TP_ENABLE_LEGACY_SLEEP_WAIT
+            std::atomic<int> counter(0); 
+            auto func = [&] () { f(); ++counter; };
+            
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            for (auto i = 0; i < count; ++i) _unsafe_queue_push_front(func);
+            lock.unlock();
+            _threads_blocker.unblock_n(static_cast<size_t>(count));
+            
+            while (counter != count) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(_thread_sleep_time_ns));
+            }
+            #else
+            CountdownLatch latch(count);
+            typedef typename std::remove_reference<F>::type Fn;
+
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            for (auto i = 0; i < count; ++i) {
+                _unsafe_queue_push_front(LatchJob<Fn>(f, latch));
+            }
+            lock.unlock();
+            _threads_blocker.unblock_n(static_cast<size_t>(count));
+
+            latch.wait();
+            #endif
+        }
+
+        template<class F> void
+        apply_for_async(const int count, F&& f) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.apply_it_num, 
+                [&](){ return count < 0; });
+            #endif
+            
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            for (auto i = 0; i < count; ++i) _unsafe_queue_push(f);
+            lock.unlock();
+            _threads_blocker.unblock_n(static_cast<size_t>(count));
+        }
+
+        /**
+        *   Run f over the range [begin, end), split
+        *   in chunks by the partitioner, and wait 
+        *   until every iteration is done.
+        *   f is called as f(b, e) on each chunk if it
+        *   accepts two arguments, otherwise as f(i)
+        *   for each i. *begin* and *end* can be
+        *   integers or random access iterators; 
+        *   a *grain* of zero is chosen automatically.
+        *   The caller computes chunks too, so it can
+        *   be used inside a job of the pool.
+        *   The first exception thrown by f is 
+        *   rethrown here.
+        */
+        template<class I, class F> void
+        parallel_for(I begin, I end, size_t grain, F&& f, 
+            Partitioner part = Partitioner::Auto) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.for_range, 
+                [&](){ return end - begin < 0; });
+            #endif
+            if (!(end - begin > 0)) return;
+
+            typedef typename std::remove_reference<F>::type Fn;
+            typedef ForState<I, Fn> State;
+            size_t n = static_cast<size_t>(end - begin);
+            size_t threads = _threads_count > 0 ? static_cast<size_t>(_threads_count) : 0;
+            size_t parts = threads + 1;
+            bool guided = part == Partitioner::Guided || part == Partitioner::Auto;
+
+            size_t chunk = grain;
+            if (part == Partitioner::Static) {
+                chunk = std::max(grain, (n + parts - 1) / parts);
+            } else if (chunk == 0) {
+                chunk = std::max<size_t>(1, n / (parts * 32));
+            }
+            size_t chunks = (n + chunk - 1) / chunk;
+            size_t helpers = std::min(threads, chunks - 1);
+
+            std::shared_ptr<State> state = 
+                std::make_shared<State>(begin, n, chunk, guided, parts, f);
+            if (helpers > 0) {
+                std::unique_lock<std::mutex> lock(_mutex_queue);
+                for (size_t i = 0; i < helpers; ++i) {
+                    _unsafe_queue_push_front([state]() { state->run(); });
+                }
+                lock.unlock();
+                _threads_blocker.unblock_n(helpers);
+            }
+            state->run();
+            state->wait();
+        }
+
+        /**
+        *   As above, with the grain chosen 
+        *   automatically.
+        */
+        template<class I, class F> void
+        parallel_for(I begin, I end, F&& f, 
+            Partitioner part = Partitioner::Auto) noexcept(false) {
+            parallel_for(begin, end, 0, std::forward<F>(f), part);
+        }
+
+        /**
+        *   Reduce the range [begin, end) with the
+        *   associative *reduce* operation, and
+        *   return the result.
+        *   Each chunk is reduced in its own padded
+        *   slot starting from *identity*, than the
+        *   slots are combined as a tree: there is no 
+        *   shared accumulator and no lock. *identity*
+        *   must be neutral for *reduce*, as it is 
+        *   used once per chunk; a *grain* of zero
+        *   is chosen automatically.
+        */
+        template<class I, class T, class R> T
+        parallel_reduce(I begin, I end, T identity, R&& reduce, 
+            size_t grain = 0) noexcept(false) {
+            return parallel_transform_reduce(begin, end, std::move(identity), 
+                std::forward<R>(reduce), [](const T& t) -> const T& { return t; }, grain);
+        }
+
+        /**
+        *   As parallel_reduce, but each element is
+        *   passed to *transform* before the reduction.
+        *   With iterators the elements are passed, 
+        *   with integers the indices.
+        */
+        template<class I, class T, class R, class M> T
+        parallel_transform_reduce(I begin, I end, T identity, R&& reduce, 
+            M&& transform, size_t grain = 0) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.for_range, 
+                [&](){ return end - begin < 0; });
+            #endif
+            if (!(end - begin > 0)) return identity;
+
+            size_t n = static_cast<size_t>(end - begin);
+            size_t parts = static_cast<size_t>(std::max(0, _threads_count.load())) + 1;
+            size_t chunks = grain == 0 ? 
+                std::min(n, parts * 4) : (n + grain - 1) / grain;
+            size_t cs = (n + chunks - 1) / chunks;
+            chunks = (n + cs - 1) / cs;
+
+            std::vector<ReduceSlot<T>> slots(chunks, ReduceSlot<T>(identity));
+            parallel_for(size_t(0), chunks, 1, [&](size_t k) {
+                I it = begin + k * cs;
+                I last = begin + std::min(n, (k + 1) * cs);
+                T acc = identity;
+                for (; it != last; ++it) acc = reduce(acc, transform(_deref(it, 0)));
+                slots[k].value = std::move(acc);
+            }, Partitioner::Dynamic);
+
+            for (size_t s = 1; s < chunks; s *= 2) {
+                size_t pairs = (chunks - s + 2 * s - 1) / (2 * s);
+                auto combine = [&](size_t p) {
+                    size_t i = p * 2 * s;
+                    slots[i].value = reduce(slots[i].value, slots[i + s].value);
+                };
+                if (pairs >= 64) {
+                    parallel_for(size_t(0), pairs, 16, combine, Partitioner::Dynamic);
+                } else {
+                    for (size_t p = 0; p < pairs; ++p) combine(p);
+                }
+            }
+            return slots[0].value;
+        }
+
+        /**
+        *   Push a job in the queue and
+        *   return a future, so you can 
+        *   track and get the result of the lambda,
+        *   or chain a continuation with then().
+        *
+        *   Inspired by vit-vit threadpool:
+        *   https://github.com/vit-vit/CTPL
+        */
+        template<class F> auto
+        future_from_push(F&& f) -> Future<decltype(f())> {
+            return future_from_push(Priority::Normal, std::forward<F>(f));
+        }
+
+        /**
+        *   As above, with a priority.
+        */
+        template<class F> auto
+        future_from_push(Priority prio, F&& f) -> Future<decltype(f())> {
+            typedef decltype(f()) R;
+            typedef typename std::decay<F>::type Fn;
+            std::shared_ptr<FutureState<R> > state = 
+                std::allocate_shared<FutureState<R> >(PoolAllocator<FutureState<R> >());
+            _bounded_push(Task(FutureJob<Fn, R>(std::forward<F>(f), state)), prio);
+            return Future<R>(std::move(state), this);
+        }
+
+        /**
+        *   Run the graph on the pool, without
+        *   waiting: the nodes without dependencies
+        *   are pushed now, the others as soon as 
+        *   their predecessors are done. 
+        *   Use TaskGraph::wait to wait the end.
+        *   A graph with a cycle is not run, the
+        *   sanity checks throw graph_cycle.
+        */
+        void
+        submit(TaskGraph& g) noexcept(false) {
+            bool acyclic = g._is_acyclic();
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.graph_cycle, 
+                [acyclic](){ return !acyclic; });
+            #endif
+            if (g._nodes.empty() || !acyclic) return;
+            if (!g._start()) {
+                #if TP_ENABLE_SANITY_CHECKS
+                    throw std::runtime_error(errors.graph_running);
+                #else
+                    return;
+                #endif
+            }
+            for (auto &n : g._nodes) {
+                if (n->dependencies == 0) _safe_queue_push(Task(GraphJob(this, &g, n.get())));
+            }
+        }
+
+        /**
+        *   Submit the graph and wait its end.
+        */
+        void
+        run(TaskGraph& g) noexcept(false) {
+            submit(g);
+            g.wait();
+        }
+
+        #if TP_ENABLE_COROUTINES
+        /**
+        *   Awaiter that moves the coroutine onto
+        *   the pool: co_await tp.schedule() 
+        *   suspends the caller and resumes it in
+        *   a pool thread. The resumption is a
+        *   small inline Task, no allocation.
+        */
+        struct ScheduleAwaiter
+        {
+            ThreadPool *pool;
+            Priority prio;
+
+            bool await_ready() const noexcept { return false; }
+
+            void
+            await_suspend(std::coroutine_handle<> h) {
+                pool->_safe_queue_push(Task([h]() { h.resume(); }), prio);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        ScheduleAwaiter
+        schedule(Priority prio = Priority::Normal) {
+            return ScheduleAwaiter{ this, prio };
+        }
+
+        /**
+        *   Start a task on the pool, the returned
+        *   future holds its result.
+        */
+        template<class T> Future<T>
+        spawn(task<T> t) {
+            std::shared_ptr<FutureState<T> > state = 
+                std::allocate_shared<FutureState<T> >(PoolAllocator<FutureState<T> >());
+            _spawn_body(this, std::move(t), state);
+            return Future<T>(std::move(state), this);
+        }
+
+        /**
+        *   Awaiter of a dispatch group: the 
+        *   coroutine is resumed on the pool when
+        *   the group has finished, no thread
+        *   is blocked.
+        */
+        struct GroupAwaiter
+        {
+            ThreadPool *pool;
+            DispatchGroupHandle group;
+
+            bool await_ready() const noexcept { return group->has_finished(); }
+
+            void
+            await_suspend(std::coroutine_handle<> h) {
+                ThreadPool *p = pool;
+                DispatchGroupHandle g = group;
+                g->on_finish([p, h]() { p->_safe_queue_push(Task([h]() { h.resume(); })); });
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        GroupAwaiter
+        dg_wait_async(const DispatchGroupHandle& g) noexcept(false) {
+            _dg_handle_check(g);
+            return GroupAwaiter{ this, g };
+        }
+
+        /**/
+        GroupAwaiter
+        dg_wait_async(const std::string& id) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            #if !TP_ENABLE_SANITY_CHECKS
+            if (!g) g = _dg_finished();
+            #endif
+            return GroupAwaiter{ this, g };
+        }
+        #endif
+
+        void
+        synchronize() {
+            _sem_job_ins_container.wait();
+        }
+
+        void
+        end_synchronize() {
+            _sem_job_ins_container.signal();
+        }
+
+        void
+        awake() {
+            if (_run_pool_thread) return;
+            _run_pool_thread = true;
+            resize(_prev_threads);
+            _threads_blocker.deactivate_barrier();
+        }
+
+        /**
+        *   Stop execution: the jobs in the queue
+        *   are kept for awake(), the ones under
+        *   processing are finished.
+        *   This is a thread blocking call, until
+        *   the threads have left their loop; they
+        *   are joined later, without waiting.
+        */ 
+        void
+        stop() {
+            if (!_run_pool_thread) return;
+            _sem_api.wait();
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            _reap_retired();
+            _prev_threads = static_cast<int>(_pool.size());
+            while (!_pool.empty()) _unsafe_thread_pop();
+            lock.unlock();
+            _run_pool_thread = false;
+            _threads_blocker.unblock(true);
+            auto &ctx = _this_thread();
+            int self = ctx.pool == this && ctx.worker && ctx.worker->retire ? 1 : 0;
+            _threads_exit_ec.wait([this, self]() { return _retiring_c == self; });
+            _sem_api.signal();
+        }
+
+        /**
+        *   Wait until all jobs
+        *   are computed.
+        *   This is a thread blocking call.
+        */
+        void
+        wait() {
+            if (!_run_pool_thread) return;
+            #if TP_ENABLE_LEGACY_SLEEP_WAIT
+            while((_push_c != 0)) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(_thread_sleep_time_ns));
+            }
+            #else
+            _jobs_done_ec.wait([this]() { return _push_c == 0; });
+            #endif
+        }
+
+        /**
+        *   Returning the current size of the 
+        *   thread pool.
+        */
+        int 
+        pool_size() const { 
+            return _threads_count; 
+        }
+
+        /**
+        *   Let the pool resize itself with the load,
+        *   between policy.min_threads and 
+        *   policy.max_threads [see AutoscalePolicy].
+        *   A background thread samples the load; 
+        *   calling it again replaces the policy.
+        *   resize() still works, and the autoscaler
+        *   does nothing while the pool is stopped.
+        */
+        void
+        enable_autoscale(const AutoscalePolicy &policy = AutoscalePolicy()) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.autoscale, [&](){ 
+                return policy.min_threads < 1 || policy.max_threads < policy.min_threads ||
+                    policy.interval.count() <= 0 || policy.keep_alive.count() < 0 ||
+                    policy.backlog_per_thread < 1 || policy.grow_samples < 1; });
+            #endif
+            std::unique_lock<std::mutex> lock(_mutex_autoscale);
+            _autoscale_policy = policy;
+            if (_autoscale_on) {
+                _autoscale_cv.notify_all();
+                return;
+            }
+            _autoscale_on = true;
+            _autoscaler = std::thread(&ThreadPool::_autoscale_loop, this);
+        }
+
+        /**
+        *   Stop the autoscaler, leaving the pool
+        *   with its current size.
+        */
+        void
+        disable_autoscale() {
+            std::unique_lock<std::mutex> lock(_mutex_autoscale);
+            if (!_autoscale_on) return;
+            _autoscale_on = false;
+            _autoscale_cv.notify_all();
+            lock.unlock();
+            _autoscaler.join();
+        }
+
+        bool
+        autoscale_enabled() {
+            std::unique_lock<std::mutex> lock(_mutex_autoscale);
+            return _autoscale_on;
+        }
+
+        size_t
+        queue_size() const {
+            return _push_c;
+        }
+
+        bool 
+        queue_is_empty() const {
+            return _push_c == 0;
+        }
+
+        /**
+        *   Snapshot of the pool counters. Without
+        *   TP_ENABLE_METRICS only the executed jobs
+        *   are counted, the rest stays zero. The
+        *   counters are read without stopping the
+        *   threads, so they may be a few jobs apart.
+        */
+        PoolStats
+        stats() {
+            PoolStats st;
+            st.queue_size = queue_size();
+            st.capacity = capacity();
+            st.dropped = _dropped_c.load(std::memory_order_relaxed);
+            st.memory = NodePool::footprint() + (_ring ? _ring->bytes() : 0);
+            st.memory_cached = NodePool::cached();
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            st.threads = static_cast<int>(_pool.size());
+            st.total = _retired_stats;
+            #if TP_ENABLE_METRICS
+            st.queue_wait = _retired_wait;
+            st.run_time = _retired_run;
+            std::uint64_t depth = _retired_depth_max;
+            #endif
+            for (auto &w : _workers) {
+                auto ws = _worker_stats(*w);
+                st.total += ws;
+                st.workers.push_back(ws);
+                #if TP_ENABLE_METRICS
+                _worker_histograms(*w, st.queue_wait, st.run_time);
+                depth = std::max(depth, w->metrics.depth_max.load(std::memory_order_relaxed));
+                #endif
+            }
+            #if TP_ENABLE_METRICS
+            st.queue_high_water = static_cast<size_t>(depth);
+            #endif
+            return st;
+        }
+
+        /**
+        *   Start recording a timeline of the pool:
+        *   for each thread the jobs it ran, with an
+        *   arrow from where they were pushed, its 
+        *   steals and sleeps, plus the dispatch 
+        *   groups opening, closing and finishing.
+        *   Each thread keeps its last 
+        *   TP_TRACE_BUFFER_SIZE events. Return false
+        *   if tracing is compiled out.
+        */
+        bool
+        enable_tracing() {
+            #if TP_ENABLE_TRACING
+            std::unique_lock<std::mutex> lock_pool(_mutex_pool);
+            std::unique_lock<std::mutex> lock(_tracer->mutex);
+            if (_tracer->on) return true;
+            _tracer->since = _now_ns();
+            _tracer->external.clear();
+            for (auto &w : _workers) {
+                if (!w->trace.load()) w->trace.store(_tracer->acquire());
+            }
+            _tracer->on = true;
+            return true;
+            #else
+            return false;
+            #endif
+        }
+
+        /**
+        *   Stop recording, the events recorded
+        *   so far can still be dumped.
+        */
+        void
+        disable_tracing() {
+            #if TP_ENABLE_TRACING
+            _tracer->on = false;
+            #endif
+        }
+
+        bool
+        tracing_enabled() const {
+            #if TP_ENABLE_TRACING
+            return _tracer->on;
+            #else
+            return false;
+            #endif
+        }
+
+        /**
+        *   Write the events recorded since the last
+        *   enable_tracing as Chrome trace event JSON,
+        *   that loads in Perfetto or chrome://tracing.
+        *   Times are in microseconds from the start.
+        */
+        bool
+        dump_trace(std::ostream &os) {
+            #if TP_ENABLE_TRACING
+            std::vector<TraceRecord> events;
+            std::uint64_t since;
+            {
+                std::unique_lock<std::mutex> lock(_tracer->mutex);
+                since = _tracer->since;
+                for (auto &r : _tracer->rings) r->read(events);
+                events.insert(events.end(), _tracer->external.begin(), _tracer->external.end());
+            }
+            _trace_json(os, events, _tracer->pid, since);
+            #else
+            os << "{\"traceEvents\":[]}\n";
+            #endif
+            return static_cast<bool>(os);
+        }
+
+        bool
+        dump_trace(const std::string &path) {
+            std::ofstream out(path);
+            return out && dump_trace(static_cast<std::ostream&>(out));
+        }
+
+        /**
+        *   The jobs run by the pool threads since 
+        *   the last enable_tracing, sorted by 
+        *   arrival: the input of a replay [see 
+        *   replay.hpp]. Empty if tracing is 
+        *   compiled out.
+        */
+        std::vector<TaskTraceRecord>
+        task_trace() {
+            std::vector<TaskTraceRecord> jobs;
+            #if TP_ENABLE_TRACING
+            std::vector<TraceRecord> events;
+            std::uint64_t since;
+            {
+                std::unique_lock<std::mutex> lock(_tracer->mutex);
+                since = _tracer->since;
+                for (auto &r : _tracer->rings) r->read(events);
+            }
+            for (auto &e : events) {
+                if (e.kind != TraceKind::Task || e.aux < since || e.aux > e.ts) continue;
+                TaskTraceRecord j;
+                j.arrival_ns = e.aux;
+                j.wait_ns = e.ts - e.aux;
+                j.duration_ns = e.dur;
+                j.group = static_cast<std::uint32_t>(e.tag >> 8);
+                j.priority = static_cast<Priority>(std::min<std::uint64_t>(e.tag & 0xff, 3));
+                jobs.push_back(j);
+            }
+            std::sort(jobs.begin(), jobs.end(), 
+                [](const TaskTraceRecord &a, const TaskTraceRecord &b) { 
+                    return a.arrival_ns < b.arrival_ns; 
+                });
+            auto first = jobs.empty() ? 0 : jobs.front().arrival_ns;
+            for (auto &j : jobs) j.arrival_ns -= first;
+            #endif
+            return jobs;
+        }
+
+        /**
+        *   Write task_trace() in the compact
+        *   binary format of task_trace_write.
+        */
+        bool
+        dump_task_trace(std::ostream &os) {
+            task_trace_write(os, task_trace());
+            return static_cast<bool>(os);
+        }
+
+        bool
+        dump_task_trace(const std::string &path) {
+            std::ofstream out(path, std::ios::binary);
+            return out && dump_task_trace(static_cast<std::ostream&>(out));
+        }
+
+        QueueMode
+        queue_mode() const {
+            return _mode;
+        }
+
+        /**
+        *   Pin the pool threads as described by
+        *   *mode*, using the cpus in *cpulist* 
+        *   [all the cpus when empty]. Threads added
+        *   later by resize are placed as well.
+        *   Return false if the OS refused to pin
+        *   some thread, or pinning is not supported.
+        */
+        bool
+        set_affinity(Affinity mode, const std::string &cpulist = "") noexcept(false) {
+            std::vector<int> cpus, all;
+            for (auto &n : _topology()) all.insert(all.end(), n.begin(), n.end());
+            std::sort(all.begin(), all.end());
+            bool parsed = cpulist_parse(cpulist, cpus);
+            if (cpus.empty() || mode == Affinity::None) {
+                cpus = all;
+            } else {
+                cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&all](int c) { 
+                    return !std::binary_search(all.begin(), all.end(), c); }), cpus.end());
+                parsed = parsed && !cpus.empty();
+            }
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.cpulist, [&](){ return !parsed; });
+            #endif
+            if (!parsed) return false;
+
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            _affinity = mode;
+            _affinity_cpus = cpus;
+            bool ok = true;
+            for (size_t i = 0; i < _workers.size(); ++i) {
+                ok = _place_worker(*_workers[i], i, true) && ok;
+            }
+            return ok;
+        }
+
+        Affinity
+        affinity() {
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            return _affinity;
+        }
+
+        /**
+        *   Number of NUMA nodes of the machine,
+        *   the valid hints of push_on_node.
+        */
+        int
+        numa_nodes() const {
+            return static_cast<int>(_node_queues.size());
+        }
+
+        /**
+        *   Set the thread sleep time.
+        *   Interval is in nanoseconds.
+        */
+        void
+        set_sleep_time_ns(const int time_ns) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.sleep_time, 
+                [&](){ return time_ns < 0; });
+            #endif
+            _thread_sleep_time_ns = time_ns;
+        }
+
+        /**
+        *   Set the thread sleep time.
+        *   Interval is in milliseconds.
+        */
+        void
+        set_sleep_time_ms(const int time_ms) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.sleep_time, 
+                [&](){ return time_ms < 0; });
+            #endif
+            _thread_sleep_time_ns = time_ms * 1000000;
+        }
+
+        /**
+        *   Set the thread sleep time.
+        *   Interval is in seconds
+        *   and can be a floating point value.
+        */
+        template<class F> void
+        set_sleep_time_s(const F time_s) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.sleep_time, 
+                [&](){ return time_s < 0; });
+            #endif
+            _thread_sleep_time_ns = static_cast<int>(time_s * 1000000000);
+        }
+
+        int 
+        sleep_time_ns() const {
+            return _thread_sleep_time_ns;
+        }
+
+        /**
+        *   Set how many pause iterations an idle
+        *   thread spins looking for work before it
+        *   sleeps: spinning saves the wake up of a
+        *   sleeping thread when jobs come at short
+        *   intervals, at the cost of some cpu. Each 
+        *   thread adapts its spin within the budget;
+        *   zero disables spinning. The default is
+        *   TP_SPIN_BUDGET, or zero on a single cpu.
+        */
+        void
+        set_spin_budget(const int iterations) noexcept(false) {
+            #if TP_ENABLE_SANITY_CHECKS
+            _condition_check(errors.spin_budget, 
+                [&](){ return iterations < 0; });
+            #endif
+            _spin_budget = iterations;
+        }
+
+        int
+        spin_budget() const {
+            return _spin_budget;
+        }
+
+        /**
+        *    ____   ____                           
+        *   |  _ \ / ___|_ __ ___  _   _ _ __  ___ 
+        *   | | | | |  _| '__/ _ \| | | | '_ \/ __|
+        *   | |_| | |_| | | | (_) | |_| | |_) \__ \
+        *   |____/ \____|_|  \___/ \__,_| .__/|___/
+        *                               |_|        
+        *
+        *   Set of functions for command dispatch_group
+        *   operations.
+        *
+        *   Each group can be used through the handle 
+        *   returned by dg_open(), that costs no lookups,
+        *   or through an std::string identifier, that 
+        *   is a thin layer over the handles.
+        *
+        *
+        *   Create a new anonymous group and return
+        *   its handle. The group stays alive until
+        *   it is closed and its jobs are done.
+        */
+        DispatchGroupHandle
+        dg_open() {
+            return _dg_trace_open(std::make_shared<DispatchGroup>());
+        }
+
+        /**
+        *   Create a new group with an std::string 
+        *   identifier.
+        */
+        void
+        dg_open(const std::string& id) noexcept(false) {
+            std::unique_lock<std::mutex> lock(_mutex_groups);
+            std::map<std::string, DispatchGroupHandle>::iterator it;
+            if (_unsafe_dg_id_check(id, it)) {
+                #if TP_ENABLE_SANITY_CHECKS
+                    throw std::runtime_error(errors.dg_not_empty(id));
+                #else
+                    return;
+                #endif
+            }   
+            _groups.insert(std::make_pair(id, _dg_trace_open(std::make_shared<DispatchGroup>(id))));
+        }
+
+        /**
+        *   Insert a job to do in a specific group.
+        *   If the group is closed, nothing is done.
+        *   Task will not start until a call to 
+        *   leave will be done.
+        */
         template<class F> void
-        set_sleep_time_s(const F time_s) noexcept(false) {
+        dg_insert(const DispatchGroupHandle& g, F&& f) noexcept(false) {
+            _dg_handle_check(g);
+            g->insert(std::forward<F>(f));
+        }
+
+        /**
+        *   Insert a job to do in a specific group.
+        *   If the group not exist, nothing is done.
+        */
+        template<class F> void
+        dg_insert(const std::string& id, F&& f) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) g->insert(std::forward<F>(f));
+        }
+
+        /**
+        *   Create a new group, insert a job on it
+        *   and dispatch it.
+        *   It is guaranteed that this job will be
+        *   the first next job to be processed by
+        *   the threadpool.
+        */
+        template<class F> DispatchGroupHandle
+        dg_now(F&& f) {
+            DispatchGroupHandle g = dg_open();
+            g->insert(std::forward<F>(f));
+            _dg_dispatch(g, true);
+            return g;
+        }
+
+        /**
+        *   As above, with an std::string identifier.
+        */
+        template<class F> void
+        dg_now(const std::string& id, F&& f) noexcept(false) {
+            DispatchGroupHandle g = std::make_shared<DispatchGroup>(id);
+            {
+                std::unique_lock<std::mutex> lock(_mutex_groups);
+                std::map<std::string, DispatchGroupHandle>::iterator it;
+                if (_unsafe_dg_id_check(id, it)) {
+                    #if TP_ENABLE_SANITY_CHECKS
+                        throw std::runtime_error(errors.dg_not_empty(id));
+                    #else
+                        return;
+                    #endif
+                }   
+                _groups.insert(std::make_pair(id, _dg_trace_open(g)));
+            }
+            g->insert(std::forward<F>(f));
+            _dg_dispatch(g, true);
+        }
+
+        /**
+        *   Signal to a group that the jobs immission 
+        *   is end, than start pushing the group jobs
+        *   to the standard threadpool queue. At the end
+        *   of the tasks, it will execute the f action,
+        *   like a barrier.
+        */
+        template<class F> void
+        dg_close_with_barrier(const DispatchGroupHandle& g, F&& f) noexcept(false) {
+            _dg_handle_check(g);
+            std::vector<Task> jobs;
+            if (!g->leave(jobs, std::forward<F>(f))) return;
+            for (auto &j : jobs) { _safe_queue_push(std::move(j)); }
+            g->release();
+        }
+
+        /**/
+        template<class F> void
+        dg_close_with_barrier(const std::string &id, F&& f) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) dg_close_with_barrier(g, std::forward<F>(f));
+        }
+
+        /**
+        *   Signal to a group that the jobs immission 
+        *   is end, than start pushing the group jobs
+        *   to the standard threadpool queue.
+        */
+        void
+        dg_close(const DispatchGroupHandle& g) noexcept(false) {
+            _dg_handle_check(g);
+            _dg_dispatch(g, false);
+        }
+
+        /**/
+        void
+        dg_close(const std::string& id) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) _dg_dispatch(g, false);
+        }
+
+        /**
+        *   Cancel a group: its jobs that have not 
+        *   started are dropped, the running ones
+        *   finish. The group still finishes [the
+        *   end action included], so dg_wait and the
+        *   barriers do not hang.
+        */
+        void
+        dg_cancel(const DispatchGroupHandle& g) noexcept(false) {
+            _dg_handle_check(g);
+            g->cancel();
+        }
+
+        /**/
+        void
+        dg_cancel(const std::string& id) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) g->cancel();
+        }
+
+        /**
+        *   Wait until every job in a group is computed.
+        *   This is a thread blocking call: the caller
+        *   sleeps until the group has finished.
+        */
+        void
+        dg_wait(const DispatchGroupHandle& g) noexcept(false) {
+            _dg_handle_check(g);
+            g->wait();
+        }
+
+        /**
+        *   As above; the id is released once the 
+        *   group has finished.
+        */
+        void
+        dg_wait(const std::string &id) noexcept(false) {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (!g) return;
+            g->wait();
+            std::unique_lock<std::mutex> lock(_mutex_groups);
+            std::map<std::string, DispatchGroupHandle>::iterator it;
+            if (_unsafe_dg_id_check(id, it) && it->second == g) {
+                _groups.erase(it);
+            }
+        }
+
+        /**
+        *   Wait until every job in a group is computed.
+        *   This is a thread blocking call. 
+        *   At the end execute the callback;
+        */
+        template<class F> void
+        dg_wait(const DispatchGroupHandle& g, F&& f) noexcept(false) {
+            dg_wait(g);
+            f();
+        }
+
+        /**/
+        template<class F> void
+        dg_wait(const std::string &id, F&& f) noexcept(false) {
+            dg_wait(id);
+            f();
+        }
+        
+        /**
+        *   The same as synchronize, but is useful
+        *   if you don't want do block all others
+        *   jobs in the queue.
+        */
+        void
+        dg_synchronize(const DispatchGroupHandle& g) noexcept(false)  {
+            _dg_handle_check(g);
+            g->synchronize();
+        }
+
+        /**/
+        void
+        dg_synchronize(const std::string &id) noexcept(false)  {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) g->synchronize();
+        }
+
+        /**/
+        void
+        dg_end_synchronize(const DispatchGroupHandle& g) noexcept(false)  {
+            _dg_handle_check(g);
+            g->end_synchronize();
+        }
+
+        /**/
+        void
+        dg_end_synchronize(const std::string& id) noexcept(false)  {
+            DispatchGroupHandle g = _safe_dg_find(id);
+            if (g) g->end_synchronize();
+        }
+
+        /**
+        *   Set a callback for excpetion handling.
+        *   If not setted, threadpool has a default
+        *   callback, that does nothing and not
+        *   rethrow.
+        */
+        template<class F> void
+        set_excpetion_action(std::function<void(F)> f) {
+            auto func = [&f] (std::exception_ptr excp) {
+                try { std::rethrow_exception(excp);
+                } catch(F e) { f(e); }
+            };
+            _sem_api.wait();
+            _exception_action = func;
+            _sem_api.signal();
+        }
+
+        /**  
+        *    ____       _            _       
+        *   |  _ \ _ __(_)_   ____ _| |_ ___ 
+        *   | |_) | '__| \ \ / / _` | __/ _ \
+        *   |  __/| |  | |\ V / (_| | ||  __/
+        *   |_|   |_|  |_| \_/ \__,_|\__\___|
+        *
+        */                                    
+    private:
+        /**
+        *   Queueing strategy choosen at construction.
+        */
+        const QueueMode _mode;
+        /**
+        *   Lock free queue used in
+        *   QueueMode::RingBuffer, null otherwise.
+        */
+        std::unique_ptr<RingBuffer> _ring;
+        /** 
+        *   Mutex for queue access. 
+        */
+        std::mutex _mutex_queue;
+        /** 
+        *   Mutex for pool resize. 
+        */
+        std::mutex _mutex_pool;
+        /** 
+        *   Mutex for groups access. 
+        */
+        std::mutex _mutex_groups;
+        /** 
+        *   Semaphore for class thread-safety. 
+        */
+        Semaphore _sem_api;
+        /**
+        *   Optional semaphore for jobs lambda data
+        *   protection in critical sections.
+        */
+        Semaphore _sem_job_ins_container;
+        /** 
+        *   Time in nanoseconds which threads
+        *   that are sleeping check for new
+        *   jobs in the queue.
+        */
+        std::atomic<int> _thread_sleep_time_ns;
+        /**
+        *   Pause iterations an idle thread spins 
+        *   before it sleeps.
+        */
+        std::atomic<int> _spin_budget;
+        /**
+        *   Flag for pool's threads state,
+        *   when false, all the threads will be
+        *   detached.
+        */
+        std::atomic<bool> _run_pool_thread;
+        /** 
+        *   Where the running threads lives, and
+        *   the retired ones not yet joined.
+        *   Guarded by _mutex_pool.
+        */
+        std::vector<std::shared_ptr<Worker> > _pool;
+        std::vector<std::shared_ptr<Worker> > _retired;
+        /**
+        *   Retired threads still in their loop, 
+        *   and the event stop() waits on.
+        */
+        std::atomic<int> _retiring_c{0};
+        EventCount _threads_exit_ec;
+        /** 
+        *   Queue of jobs to do. In WorkStealing
+        *   mode it is the injection queue.
+        */
+        PriorityQueue _queue;
+        /**
+        *   Size of _queue, and number of its High
+        *   and Critical jobs, readable without
+        *   taking _mutex_queue.
+        */
+        std::atomic<int> _queue_c;
+        std::atomic<int> _queue_urgent_c;
+        /**
+        *   Queues of the jobs pushed with a node
+        *   hint, and their total size.
+        */
+        std::vector<std::unique_ptr<NodeQueue> > _node_queues;
+        std::atomic<int> _node_c;
+        /**
+        *   Placement of the threads, and the cpus 
+        *   it is restricted to. Guarded by _mutex_pool.
+        */
+        Affinity _affinity = Affinity::None;
+        std::vector<int> _affinity_cpus;
+        /**
+        *   State of the running threads, one for
+        *   each thread in _pool. Guarded by _mutex_pool.
+        */
+        std::vector<std::shared_ptr<Worker> > _workers;
+        /**
+        *   Incremented every time _workers changes,
+        *   so the stealers know when to refresh
+        *   their victims.
+        */
+        std::atomic<int> _workers_version;
+        /**
+        *   Counters of the threads that left the
+        *   pool. Guarded by _mutex_pool.
+        */
+        ThreadStats _retired_stats;
+        #if TP_ENABLE_METRICS
+        LatencyHistogram _retired_wait;
+        LatencyHistogram _retired_run;
+        std::uint64_t _retired_depth_max = 0;
+        #endif
+        #if TP_ENABLE_TRACING
+        std::shared_ptr<Tracer> _tracer;
+        #endif
+        /** 
+        *   A map of in process groups of jobs.
+        */
+        std::map<std::string, DispatchGroupHandle> _groups;
+        /** 
+        *   The number of threads currently in the pool.
+        */
+        std::atomic<int> _threads_count;
+        /** 
+        *   When zero means that all the task
+        *   were executed and no one is 
+        *   waiting.
+        */
+        std::atomic<int> _push_c;
+        /**
+        *   Notified when _push_c drops to zero.
+        */
+        EventCount _jobs_done_ec;
+        /**
+        *   Bound of _push_c for the user's pushes
+        *   [0 for none], what to do over it, and 
+        *   the producers waiting for room, notified
+        *   by each completed job.
+        */
+        std::atomic<int> _capacity{0};
+        std::atomic<OverflowPolicy> _overflow{OverflowPolicy::Block};
+        std::atomic<std::uint64_t> _dropped_c{0};
+        EventCount _space_ec;
+        /**
+        *   Bytes of free nodes kept by the 
+        *   allocator when the pool goes idle.
+        */
+        std::atomic<size_t> _memory_reserve{TP_MEMORY_RESERVE};
+        /**
+        *   Number of threads that the pool had
+        *   when a stop() was called. Used
+        *   by the awake() method to restore the 
+        *   same number of threads.
+        */
+        std::atomic<int> _prev_threads;
+        /**
+        *   Autoscaler thread and its policy, 
+        *   guarded by _mutex_autoscale.
+        */
+        std::thread _autoscaler;
+        AutoscalePolicy _autoscale_policy;
+        bool _autoscale_on = false;
+        std::mutex _mutex_autoscale;
+        std::condition_variable _autoscale_cv;
+        /**
+        *   Pending timers, the thread that fires
+        *   them [started by the first timer] and
+        *   the tick it sleeps until, guarded by
+        *   _mutex_timers. The ticks count from
+        *   _timer_origin.
+        */
+        TimerWheel _timers;
+        std::thread _timer_thread;
+        bool _timers_on = false;
+        bool _timers_closed = false;
+        std::uint64_t _timer_wake = 0;
+        const std::chrono::steady_clock::time_point _timer_origin = 
+            std::chrono::steady_clock::now();
+        std::mutex _mutex_timers;
+        std::condition_variable _timers_cv;
+        /**
+        *   Callback for excpetion handling setted by the user.
+        */
+        std::function<void(std::exception_ptr)> _exception_action; 
+        std::mutex _mutex_exceptions;
+        /**
+        *   Manage the threads waiting.
+        */
+        ThreadsBlocker _threads_blocker;
+
+        /**
+        *   String errors that are throw when user 
+        *   submit wrong inputs or try to do illegal
+        *   operations.
+        */
+        struct Errors 
+        {            
+            std::string 
+            dg_empty(const std::string& id) {
+                return "ThreadPool: group with id " + id + " not exist";
+            };
+            
+            std::string 
+            dg_not_empty(const std::string& id) {
+                return "ThreadPool: group with id " + id + " already exist";
+            };
+            
+            std::string sleep_time = 
+                "ThreadPool: sleep time value must be greater or equal to zero";
+            
+            std::string apply_it_num =
+                "ThreadPool: Number of iterations in apply must be greater than zero";
+            
+            std::string dg_handle = 
+                "ThreadPool: dispatch group handle is null";
+
+            std::string for_range = 
+                "ThreadPool: parallel_for end must not precede begin";
+
+            std::string graph_cycle = 
+                "ThreadPool: the task graph has a cycle";
+
+            std::string graph_running = 
+                "ThreadPool: the task graph is already running";
+
+            std::string autoscale = 
+                "ThreadPool: autoscale needs 1 <= min_threads <= max_threads and positive parameters";
+
+            std::string timer_period = 
+                "ThreadPool: push_every period must be greater than zero";
+
+            std::string spin_budget = 
+                "ThreadPool: spin budget must be greater or equal to zero";
+
+            std::string cpulist = 
+                "ThreadPool: malformed cpulist or no cpu of the list is online";
+
+            std::string resize_alloc = 
+                "ThreadPool: Number of threads in resize or alloc must be greater than zero";
+        } errors;
+
+        /**
+        *   Given a condition to check, throw an error
+        *   if the condition is true.
+        */
+        template<class M, class T> void 
+        _condition_check(M&& m, T&& t) noexcept(false) {
+            if (t()) throw std::runtime_error(m);
+        }
+
+        /**
+        *   Element pointed by an iterator, or 
+        *   the value itself for an integer.
+        *   Used by parallel_transform_reduce.
+        */
+        template<class I> static auto
+        _deref(const I& it, int) -> decltype(*it) {
+            return *it;
+        }
+
+        template<class I> static const I&
+        _deref(const I& it, long) {
+            return it;
+        }
+
+        /**
+        *   Check if the groups map contains or
+        *   not the required id. Used
+        *   by dispatch_group methods.
+        */
+        bool
+        _unsafe_dg_id_check(const std::string &id, 
+            std::map<std::string, DispatchGroupHandle>::iterator& it) {
+            it = _groups.find(id);
+            return (it == _groups.end()) ? false : true;
+        }
+
+        /**
+        *   Find the handle of a group by id; the
+        *   lock is held only for the lookup.
+        *   Return a null handle if the group not 
+        *   exist and sanity checks are disabled.
+        */
+        DispatchGroupHandle
+        _safe_dg_find(const std::string &id) noexcept(false) {
+            std::unique_lock<std::mutex> lock(_mutex_groups);
+            std::map<std::string, DispatchGroupHandle>::iterator it;
+            if (!_unsafe_dg_id_check(id, it)) {
+                #if TP_ENABLE_SANITY_CHECKS
+                    throw std::runtime_error(errors.dg_empty(id));
+                #else
+                    return DispatchGroupHandle();
+                #endif
+            }
+            return it->second;
+        }
+
+        /**/
+        void
+        _dg_handle_check(const DispatchGroupHandle& g) noexcept(false) {
             #if TP_ENABLE_SANITY_CHECKS
-            _condition_check(errors.sleep_time, 
-                [&](){ return time_s < 0; });
+                _condition_check(errors.dg_handle, [&g]() { return !g; });
+            #endif
+        }
+
+        /**
+        *   Close a group and push its jobs: to the
+        *   front of the queue if *front* is true.
+        *   The "open" token is released only after
+        *   the push, so the group can't finish early.
+        */
+        void
+        _dg_dispatch(const DispatchGroupHandle& g, bool front) {
+            std::vector<Task> jobs;
+            if (!g->leave(jobs)) return;
+            #if TP_ENABLE_TRACING
+            if (_tracer->on) {
+                std::shared_ptr<Tracer> tracer(_tracer);
+                std::string id = g->id();
+                const void *handle = g.get();
+                tracer->group(TraceKind::GroupClose, id, handle);
+                g->on_finish(Task([tracer, id, handle]() {
+                    tracer->group(TraceKind::GroupFinish, id, handle);
+                }));
+            }
+            #endif
+            if (front) {
+                for (auto j = jobs.rbegin(); j != jobs.rend(); ++j) {
+                    _safe_queue_push_front(std::move(*j), Priority::Critical);
+                }
+            } else {
+                for (auto &j : jobs) { _safe_queue_push(std::move(j)); }
+            }
+            g->release();
+        }
+
+        /**
+        *   Record the opening of a group in
+        *   the trace, if tracing is on.
+        */
+        DispatchGroupHandle
+        _dg_trace_open(DispatchGroupHandle g) {
+            #if TP_ENABLE_TRACING
+            _tracer->group(TraceKind::GroupOpen, g->id(), g.get());
+            #endif
+            return g;
+        }
+
+        #if TP_ENABLE_COROUTINES
+        /**
+        *   An empty group, already finished.
+        */
+        DispatchGroupHandle
+        _dg_finished() {
+            DispatchGroupHandle g = dg_open();
+            _dg_dispatch(g, false);
+            return g;
+        }
+
+        /**
+        *   Coroutine that starts itself, runs a 
+        *   spawned task on the pool and frees its
+        *   frame at the end.
+        */
+        struct DetachedCoroutine
+        {
+            struct promise_type
+            {
+                DetachedCoroutine get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        template<class T> static DetachedCoroutine
+        _spawn_body(ThreadPool *tp, task<T> t, std::shared_ptr<FutureState<T> > s) {
+            co_await tp->schedule();
+            try {
+                if constexpr (std::is_void<T>::value) {
+                    co_await std::move(t);
+                    s->set_value();
+                } else {
+                    s->set_value(co_await std::move(t));
+                }
+            } catch(...) {
+                s->set_exception(std::current_exception());
+            }
+        }
+        #endif
+
+        /**
+        *   Called by pools threads when
+        *   an excpetion occours.
+        */
+        template<class F> void
+        _exc_exception_action(F excpetion) {
+            _exception_action(excpetion);
+        }
+
+        /**
+        *   Lock the queue mutex for
+        *   a safe insertion in the queue.
+        *   *counted*: the job is already in
+        *   _push_c [see _reserve_slot].
+        */
+        template<class F> void
+        _safe_queue_push(F&& t, Priority p = Priority::Normal, bool counted = false) {
+            if (_mode == QueueMode::WorkStealing && p == Priority::Normal) {
+                auto &ctx = _this_thread();
+                if (ctx.pool == this && ctx.worker) {
+                    _ws_local_push(*ctx.worker, std::forward<F>(t), counted);
+                    return;
+                }
+            }
+            if (!counted) ++_push_c;
+            if (_mode == QueueMode::RingBuffer && p == Priority::Normal) {
+                if (_ring->try_push(std::forward<F>(t))) {
+                    _threads_blocker.unblock_n(1);
+                    return;
+                }
+            }
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            _unsafe_queue_insert(std::forward<F>(t), p, false);
+            _threads_blocker.unblock_n(1);
+        }
+
+        /**
+        *   Insert in _queue and update its 
+        *   counters, with _mutex_queue locked.
+        */
+        template<class F> void
+        _unsafe_queue_insert(F&& t, Priority p, bool front) {
+            if (front) _queue.emplace_front(std::forward<F>(t), p);
+            else _queue.emplace_back(std::forward<F>(t), p);
+            ++_queue_c;
+            if (p >= Priority::High) ++_queue_urgent_c;
+        }
+
+        /**
+        *   Push a batch of jobs with one lock of
+        *   the queue and one wake up call. From a
+        *   work stealing thread the jobs go to its
+        *   own deque, in ring mode to the ring 
+        *   while it has room.
+        */
+        void
+        _safe_queue_push_bulk(std::vector<Task> &tasks) {
+            size_t n = tasks.size();
+            if (n == 0) return;
+            _push_c += static_cast<int>(n);
+            size_t i = 0;
+            auto &ctx = _this_thread();
+            if (_mode == QueueMode::WorkStealing && ctx.pool == this && ctx.worker) {
+                for (; i < n; ++i) {
+                    _stamp(tasks[i]);
+                    ctx.worker->deque.push(_new_node(std::move(tasks[i])));
+                }
+            } else if (_mode == QueueMode::RingBuffer) {
+                while (i < n && _ring->try_push(std::move(tasks[i]))) ++i;
+            }
+            if (i < n) {
+                std::unique_lock<std::mutex> lock(_mutex_queue);
+                for (; i < n; ++i) {
+                    _unsafe_queue_insert(std::move(tasks[i]), Priority::Normal, false);
+                }
+            }
+            _threads_blocker.unblock_n(n);
+        }
+
+        /**
+        *   Push of the user's jobs, through the
+        *   overflow policy when a capacity is set.
+        */
+        void
+        _bounded_push(Task &&t, Priority p = Priority::Normal) {
+            t.droppable = true;
+            if (_capacity.load(std::memory_order_relaxed) != 0 && !_admit(t)) return;
+            _safe_queue_push(std::move(t), p);
+        }
+
+        /**
+        *   With a capacity the batch is pushed
+        *   job by job, each one admitted alone.
+        */
+        void
+        _bounded_push_bulk(std::vector<Task> &tasks) {
+            if (_capacity.load(std::memory_order_relaxed) == 0) {
+                for (auto &t : tasks) t.droppable = true;
+                _safe_queue_push_bulk(tasks);
+                return;
+            }
+            for (auto &t : tasks) _bounded_push(std::move(t));
+        }
+
+        /**
+        *   Count a job in _push_c only if the 
+        *   pool is below its capacity, so racing
+        *   producers cannot overshoot it.
+        */
+        bool
+        _reserve_slot() {
+            auto cap = _capacity.load(std::memory_order_relaxed);
+            int c = _push_c.load();
+            do {
+                if (cap != 0 && c >= cap) return false;
+            } while (!_push_c.compare_exchange_weak(c, c + 1));
+            return true;
+        }
+
+        /**
+        *   Push a job whose slot has been taken
+        *   by _reserve_slot, bypassing the policy.
+        */
+        template<class F> void
+        _reserved_push(F&& f) {
+            Task t;
+            try {
+                t = Task(std::forward<F>(f));
+            } catch (...) {
+                _job_done();
+                throw;
+            }
+            t.droppable = true;
+            _safe_queue_push(std::move(t), Priority::Normal, true);
+        }
+
+        bool
+        _has_space() const {
+            auto cap = _capacity.load(std::memory_order_relaxed);
+            return cap == 0 || _push_c < cap;
+        }
+
+        /**
+        *   Apply the overflow policy to *t* if the
+        *   pool is full. Return true to push it,
+        *   false if the caller has run it.
+        */
+        bool
+        _admit(Task &t) {
+            if (_has_space()) return true;
+            auto policy = _overflow.load(std::memory_order_relaxed);
+            if (policy == OverflowPolicy::CallerRuns) {
+                if (!t.cancelled()) _call_job(t);
+                return false;
+            }
+            if (policy == OverflowPolicy::DropOldest && _drop_oldest()) return true;
+            auto &ctx = _this_thread();
+            if (ctx.pool != this || !ctx.worker) {
+                _space_ec.wait([this]() { return _has_space(); });
+            }
+            return true;
+        }
+
+        /**
+        *   Drop the oldest droppable job of the 
+        *   lowest level: from _queue, or from the
+        *   ring [Normal jobs] unless _queue has a
+        *   Low one. The pool's own jobs met in the
+        *   ring move to the front of _queue. The
+        *   jobs in the work stealing deques and in
+        *   the node queues are not dropped.
+        */
+        bool
+        _drop_oldest() {
+            Task t;
+            {
+                std::unique_lock<std::mutex> lock(_mutex_queue);
+                t = _queue_pop_droppable(static_cast<int>(Priority::Normal));
+                if (!t && _ring) {
+                    std::vector<Task> kept;
+                    Task r;
+                    while (_ring->try_pop(r)) {
+                        if (r.droppable) {
+                            t = std::move(r);
+                            break;
+                        }
+                        kept.push_back(std::move(r));
+                    }
+                    for (auto j = kept.rbegin(); j != kept.rend(); ++j) {
+                        _unsafe_queue_insert(std::move(*j), Priority::Normal, true);
+                    }
+                }
+                if (!t) t = _queue_pop_droppable(PriorityQueue::levels);
+            }
+            if (!t) return false;
+            t = nullptr;
+            _dropped_c.fetch_add(1, std::memory_order_relaxed);
+            _job_done();
+            return true;
+        }
+
+        /**
+        *   Pop from _queue the oldest droppable
+        *   job below the level *below*, with 
+        *   _mutex_queue locked.
+        */
+        Task
+        _queue_pop_droppable(int below) {
+            Priority p = Priority::Low;
+            Task t = _queue.pop_droppable(p, below);
+            if (t) {
+                --_queue_c;
+                if (p >= Priority::High) --_queue_urgent_c;
+            }
+            return t;
+        }
+
+        /**
+        *   Modify the queue in UNSAFE 
+        *   manner, so you should lock
+        *   the queue outside this function,
+        *   and wake the threads after the unlock.
+        */
+        template<class F> void
+        _unsafe_queue_push(F&& t) {
+            ++_push_c;
+            _unsafe_queue_insert(std::forward<F>(t), Priority::Normal, false);
+        }
+
+        /**
+        *   Lock the queue mutex for
+        *   a safe insertion in the queue.
+        *   Insert the element at the front of 
+        *   its priority level.
+        */
+        template<class F> void
+        _safe_queue_push_front(F&& t, Priority p = Priority::High) {
+            ++_push_c;
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            _unsafe_queue_insert(std::forward<F>(t), p, true);
+            _threads_blocker.unblock_n(1);
+        }
+
+        /**
+        *   Modify the queue in UNSAFE 
+        *   manner, so you should lock
+        *   the queue outside this function,
+        *   and wake the threads after the unlock.
+        *   Insert the element at the front of 
+        *   its priority level.
+        */
+        template<class F> void
+        _unsafe_queue_push_front(F&& t, Priority p = Priority::High) {
+            ++_push_c;
+            _unsafe_queue_insert(std::forward<F>(t), p, true);
+        }
+
+        /**
+        *   Lock the queue mutex, safely pop
+        *   job from the queue if not empty.
+        */
+        Task
+        _safe_queue_pop() {
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            if (_queue.empty()) {
+                return Task();
+            } 
+
+            Priority p;
+            auto t = _queue.pop(p);
+            --_queue_c;
+            if (p >= Priority::High) --_queue_urgent_c;
+            return t;
+        }
+
+        /**
+        *   Pop the next job according to the
+        *   queue mode. Return an empty Task
+        *   if there is nothing to do.
+        */
+        Task
+        _pop_job(Worker &w) {
+            Task t;
+            if (_node_c != 0 && _queue_urgent_c == 0) {
+                t = _node_pop(static_cast<size_t>(w.node.load(std::memory_order_relaxed)));
+                if (t) return t;
+            }
+            switch (_mode) {
+            case QueueMode::WorkStealing:
+                t = _ws_pop(w);
+                break;
+            case QueueMode::RingBuffer:
+                t = _ring_pop();
+                break;
+            default:
+                t = _safe_queue_pop();
+            }
+            if (!t && _node_c != 0) {
+                t = _node_steal(static_cast<size_t>(w.node.load(std::memory_order_relaxed)));
+            }
+            return t;
+        }
+
+        /**
+        *   Pop a job from the queue of a node.
+        */
+        Task
+        _node_pop(size_t node) {
+            auto &q = *_node_queues[node % _node_queues.size()];
+            std::unique_lock<std::mutex> lock(q.mutex);
+            if (q.jobs.empty()) return Task();
+            Task t = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            --_node_c;
+            return t;
+        }
+
+        /**
+        *   Pop a job from the node queues, starting 
+        *   from *home* and going to the remote ones.
+        */
+        Task
+        _node_steal(size_t home) {
+            for (size_t k = 0; k < _node_queues.size() && _node_c != 0; ++k) {
+                auto t = _node_pop(home + k);
+                if (t) return t;
+            }
+            return Task();
+        }
+
+        /**
+        *   True if _pop_job can find a job.
+        *   Checked by a thread after it registered
+        *   itself as waiting, so a job pushed in the
+        *   meanwhile does not go unnoticed.
+        */
+        bool
+        _has_work(Worker &w) {
+            if (_node_c != 0) return true;
+            switch (_mode) {
+            case QueueMode::WorkStealing:
+                return _ws_has_work(w);
+            case QueueMode::RingBuffer:
+                return _queue_c != 0 || !_ring->empty();
+            default:
+                return _queue_c != 0;
+            }
+        }
+
+        /**
+        *   Ring buffer pop: the ring holds only
+        *   Normal jobs, so High and Critical jobs 
+        *   in _queue are served first, the others
+        *   [Low and overflowed jobs] when the 
+        *   ring is empty.
+        */
+        Task
+        _ring_pop() {
+            if (_queue_urgent_c != 0) {
+                auto t = _safe_queue_pop();
+                if (t) return t;
+            }
+            Task t;
+            if (_ring->try_pop(t)) return t;
+            if (_queue_c != 0) return _safe_queue_pop();
+            return t;
+        }
+
+        /**
+        *   The pool and worker of the calling
+        *   thread, both null for threads that 
+        *   do not belong to any pool.
+        */
+        static ThreadContext&
+        _this_thread() {
+            static thread_local ThreadContext ctx = { nullptr, nullptr, 0 };
+            return ctx;
+        }
+
+        /**
+        *   Push a job on the deque of the calling
+        *   pool thread. Only the owner can call it.
+        */
+        template<class F> void
+        _ws_local_push(Worker &w, F&& t, bool counted = false) {
+            if (!counted) ++_push_c;
+            auto job = _new_node(std::forward<F>(t));
+            _stamp(*job);
+            w.deque.push(job);
+            _threads_blocker.unblock_n(1);
+        }
+
+        /**
+        *   Work stealing pop: High and Critical
+        *   jobs first, than the own deque, than the 
+        *   injection queue, than the others 
+        *   workers' deques.
+        */
+        Task
+        _ws_pop(Worker &w) {
+            if (_queue_urgent_c != 0) {
+                auto t = _safe_queue_pop();
+                if (t) return t;
+            }
+            if (auto j = w.deque.pop()) return _ws_unwrap(j);
+            if (_queue_c != 0) {
+                auto t = _safe_queue_pop();
+                if (t) return t;
+            }
+            return _ws_steal(w);
+        }
+
+        /**
+        *   Try to steal one job from the others
+        *   workers, starting from a random one.
+        */
+        Task
+        _ws_steal(Worker &w) {
+            if (w.victims_version != _workers_version) {
+                std::unique_lock<std::mutex> lock(_mutex_pool);
+                w.victims = _workers;
+                w.victims_version = _workers_version;
+            }
+            auto n = w.victims.size();
+            if (n < 2) return Task();
+            auto first = w.next_random() % n;
+            for (size_t i = 0; i < n; ++i) {
+                auto &v = w.victims[(first + i) % n];
+                if (v.get() == &w) continue;
+                if (auto j = v->deque.steal()) {
+                    _probe_stolen(w);
+                    return _ws_unwrap(j);
+                }
+            }
+            return Task();
+        }
+
+        /**
+        *   True if some job can be found by _ws_pop.
+        *   Used before going to sleep to avoid
+        *   missing a job pushed in the meanwhile.
+        */
+        bool
+        _ws_has_work(Worker &w) {
+            if (_queue_c != 0) return true;
+            for (auto &v : w.victims) {
+                if (!v->deque.empty()) return true;
+            }
+            return false;
+        }
+
+        Task
+        _ws_unwrap(Task *j) {
+            auto t = std::move(*j);
+            _delete_node(j);
+            return t;
+        }
+
+        /**
+        *   Nodes of the work stealing deques, 
+        *   recycled by NodePool.
+        */
+        template<class F> static Task*
+        _new_node(F&& f) {
+            Task *j = PoolAllocator<Task>().allocate(1);
+            try {
+                ::new (j) Task(std::forward<F>(f));
+            } catch (...) {
+                PoolAllocator<Task>().deallocate(j, 1);
+                throw;
+            }
+            return j;
+        }
+
+        static void
+        _delete_node(Task *j) noexcept {
+            j->~Task();
+            PoolAllocator<Task>().deallocate(j, 1);
+        }
+
+        /**
+        *   Called by a worker that is leaving the
+        *   pool: its pending jobs are moved to the
+        *   injection queue so nobody loses them.
+        */
+        void
+        _release_worker(Worker &w) {
+            std::unique_lock<std::mutex> lock_pool(_mutex_pool);
+            _workers.erase(std::remove_if(_workers.begin(), _workers.end(), 
+                [&w](const std::shared_ptr<Worker> &p) { return p.get() == &w; }), 
+                _workers.end());
+            ++_workers_version;
+            _retired_stats += _worker_stats(w);
+            #if TP_ENABLE_METRICS
+            _worker_histograms(w, _retired_wait, _retired_run);
+            _retired_depth_max = std::max(_retired_depth_max, 
+                w.metrics.depth_max.load(std::memory_order_relaxed));
             #endif
-            _thread_sleep_time_ns = static_cast<int>(time_s * 1000000000);
+            lock_pool.unlock();
+            #if TP_ENABLE_TRACING
+            if (auto r = w.trace.exchange(nullptr)) {
+                std::unique_lock<std::mutex> lock_trace(_tracer->mutex);
+                _tracer->free_rings.push_back(r);
+            }
+            #endif
+            w.victims.clear();
+            std::unique_lock<std::mutex> lock(_mutex_queue);
+            while (auto j = w.deque.pop()) {
+                _unsafe_queue_insert(_ws_unwrap(j), Priority::Normal, false);
+            }
+            if (_queue_c != 0 || _node_c != 0 || (_ring && !_ring->empty())) {
+                _threads_blocker.unblock();
+            }
         }
 
-        int 
-        sleep_time_ns() const {
-            return _thread_sleep_time_ns;
+        /**
+        *   Called when the ThreadPool is created 
+        *   or the user has required a resize 
+        *   operation.
+        */
+        void 
+        _safe_thread_push() {
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            auto w = std::make_shared<Worker>();
+            w->seed += static_cast<std::uint32_t>(_workers.size()) * 0x61C88647u;
+            #if TP_ENABLE_TRACING
+            if (_tracer->on) {
+                std::unique_lock<std::mutex> lock_trace(_tracer->mutex);
+                w->trace.store(_tracer->acquire());
+            }
+            #endif
+            _workers.push_back(w);
+            ++_workers_version;
+            w->thread = std::thread(&ThreadPool::_thread_loop_mth, this, w);
+            _pool.push_back(w);
+            _place_worker(*w, _workers.size() - 1, false);
+            ++_threads_count;
         }
 
         /**
-        *    ____   ____                           
-        *   |  _ \ / ___|_ __ ___  _   _ _ __  ___ 
-        *   | | | | |  _| '__/ _ \| | | | '_ \/ __|
-        *   | |_| | |_| | | | (_) | |_| | |_) \__ \
-        *   |____/ \____|_|  \___/ \__,_| .__/|___/
-        *                               |_|        
-        *
-        *   Set of functions for command dispatch_group
-        *   operations.
-        *
-        *
-        *   Create a new group with an std::string 
-        *   identifier.
+        *   The NUMA topology, read once.
+        */
+        static const std::vector<std::vector<int> >&
+        _topology() {
+            static const std::vector<std::vector<int> > nodes = numa_topology();
+            return nodes;
+        }
+
+        /**
+        *   Node of a cpu, 0 if it is unknown.
+        */
+        static int
+        _cpu_node(int cpu) {
+            auto &nodes = _topology();
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                if (std::binary_search(nodes[n].begin(), nodes[n].end(), cpu)) {
+                    return static_cast<int>(n);
+                }
+            }
+            return 0;
+        }
+
+        /**
+        *   Pin the i-th worker according to 
+        *   _affinity, with _mutex_pool locked.
+        *   With Affinity::None a new thread is
+        *   left alone, and *reset* unpins it.
+        */
+        bool
+        _place_worker(Worker &w, size_t i, bool reset) {
+            auto &nodes = _topology();
+            std::vector<int> cpus;
+            switch (_affinity) {
+            case Affinity::Cores:
+                cpus.push_back(_affinity_cpus[i % _affinity_cpus.size()]);
+                w.node = _cpu_node(cpus[0]);
+                break;
+            case Affinity::CoreSet:
+                cpus = _affinity_cpus;
+                w.node = _cpu_node(cpus[0]);
+                break;
+            case Affinity::NumaNodes: {
+                std::vector<size_t> used;
+                for (size_t n = 0; n < nodes.size(); ++n) {
+                    if (_affinity_cpus.empty() || std::find_first_of(nodes[n].begin(), 
+                        nodes[n].end(), _affinity_cpus.begin(), _affinity_cpus.end()) 
+                        != nodes[n].end()) used.push_back(n);
+                }
+                size_t n = used[i % used.size()];
+                for (auto c : nodes[n]) {
+                    if (_affinity_cpus.empty() || std::binary_search(
+                        _affinity_cpus.begin(), _affinity_cpus.end(), c)) cpus.push_back(c);
+                }
+                w.node = static_cast<int>(n);
+                break;
+            }
+            default:
+                w.node = static_cast<int>(i % nodes.size());
+                if (!reset) return true;
+                cpus = _affinity_cpus;
+            }
+            return _pin_thread(w.thread.native_handle(), cpus);
+        }
+
+        /**
+        *   Restrict a thread to a set of cpus.
+        */
+        static bool
+        _pin_thread(std::thread::native_handle_type h, const std::vector<int> &cpus) {
+            #if TP_ENABLE_AFFINITY
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (auto c : cpus) {
+                if (c < CPU_SETSIZE) CPU_SET(c, &set);
+            }
+            return pthread_setaffinity_np(h, sizeof(set), &set) == 0;
+            #else
+            return false;
+            #endif
+        }
+
+        /**
+        *   Called when the ThreadPool is deleted 
+        *   or the user has required both a resize 
+        *   operation or a stop operation.
+        */
+        void 
+        _safe_thread_pop() {
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            _reap_retired();
+            _unsafe_thread_pop();
+        }
+
+        /**
+        *   Retire the last thread, with _mutex_pool
+        *   locked: it is woken up if it sleeps, and
+        *   leaves the loop after its current job. 
+        *   It does not wait for the thread.
         */
         void
-        dg_open(const std::string& id) noexcept(false) {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_not_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            _groups.insert(std::make_pair(id, DispatchGroup(id)));
+        _unsafe_thread_pop() {
+            if (_pool.empty()) return;
+            auto w = _pool.back();
+            _pool.pop_back();
+            --_threads_count;
+            w->retire = true;
+            ++_retiring_c;
+            _retired.push_back(w);
+            _threads_blocker.cancel_wait(&w->sem);
+            w->sem.signal();
         }
 
         /**
-        *   Insert a job to do in a specific group.
-        *   If the group not exist, nothing is done.
-        *   Task will not start until a call to 
-        *   leave will be done.
+        *   Join the retired threads that have left
+        *   their loop, with _mutex_pool locked.
+        *   Called when the pool shrinks, so those
+        *   threads have usually finished exiting
+        *   and the join does not wait.
         */
-        template<class F> void
-        dg_insert(const std::string& id, F&& f) noexcept(false) {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            it->second.insert(f);
+        void
+        _reap_retired() {
+            auto it = std::remove_if(_retired.begin(), _retired.end(), 
+                [](const std::shared_ptr<Worker> &w) { 
+                    if (!w->exited) return false;
+                    w->thread.join();
+                    return true;
+                });
+            _retired.erase(it, _retired.end());
+        }
+
+        /**
+        *   Join every retired thread but the calling
+        *   one, which is detached.
+        */
+        void
+        _join_retired() {
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            std::vector<std::shared_ptr<Worker> > retired;
+            retired.swap(_retired);
+            lock.unlock();
+            for (auto &w : retired) {
+                if (w->thread.get_id() != std::this_thread::get_id()) {
+                    w->thread.join();
+                } else {
+                    w->thread.detach();
+                }
+            }
+        }
+
+        /**
+        *   Called by a worker going to sleep: its
+        *   free nodes go to the shared depot, that
+        *   is trimmed if the pool has nothing to do.
+        */
+        void
+        _reclaim_memory() noexcept {
+            NodePool::flush();
+            if (_push_c == 0) NodePool::trim(memory_reserve());
+        }
+
+        /**
+        *   Each thread start run this function
+        *   when the thread is created, and 
+        *   exit only when the pool is destructed
+        *   or the stop() function is called.
+        *   The thread go to sleep if the 
+        *   queue is empty. 
+        */
+        void 
+        _thread_loop_mth(std::shared_ptr<Worker> worker) {
+            Semaphore &sem = worker->sem;
+            _this_thread().pool = this;
+            _this_thread().worker = worker.get();
+            /**
+            *   Wait until _safe_thread_push has
+            *   pinned the thread.
+            */
+            {
+                std::unique_lock<std::mutex> lock(_mutex_pool);
+            }
+            while(!worker->retire.load(std::memory_order_relaxed)) {
+                auto funcf = _pop_job(*worker);
+                if (!funcf) {
+                    _probe_idle(*worker);
+                    if (_spin_for_work(*worker)) continue;
+                    _reclaim_memory();
+                    if (_threads_blocker.thread_wait(&sem)) {
+                        if (!_has_work(*worker)) {
+                            auto parked = _now_ns();
+                            sem.wait();
+                            _probe_parked(*worker, parked);
+                        }
+                        else _threads_blocker.cancel_wait(&sem);
+                    }
+                    continue; 
+                }
+                if (funcf.cancelled()) {
+                    funcf = nullptr;
+                    _job_done();
+                    continue;
+                }
+                auto probe = _probe_started(*worker, funcf);
+                worker->busy.store(true, std::memory_order_relaxed);
+                _call_job(funcf);
+                worker->busy.store(false, std::memory_order_relaxed);
+                _probe_ran(*worker, probe);
+                worker->done.store(worker->done.load(std::memory_order_relaxed) + 1, 
+                    std::memory_order_relaxed);
+                _job_done();
+            }
+            _probe_resumed(*worker);
+            _threads_blocker.cancel_wait(&sem);
+            _release_worker(*worker);
+            _this_thread().pool = nullptr;
+            _this_thread().worker = nullptr;
+            worker->exited = true;
+            --_retiring_c;
+            _threads_exit_ec.notify_all();
+        }
+
+        /**
+        *   Tick of a time point, rounded up so that
+        *   a timer never fires early.
+        */
+        std::uint64_t
+        _timer_tick(std::chrono::steady_clock::time_point when) const {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when - _timer_origin).count();
+            return ns <= 0 ? 0 : (static_cast<std::uint64_t>(ns) + TP_TIMER_TICK_US * 1000 - 1) / 
+                (TP_TIMER_TICK_US * 1000);
+        }
+
+        template<class Clock, class Duration> std::uint64_t
+        _timer_tick(const std::chrono::time_point<Clock, Duration> &when) const {
+            return _timer_tick(std::chrono::steady_clock::now() + 
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(when - Clock::now()));
+        }
+
+        /**
+        *   Add a timer to the wheel, waking the timer
+        *   thread only if it sleeps past the new 
+        *   deadline. Return 0, dropping the job, once 
+        *   the pool is being destroyed.
+        */
+        TimerId
+        _timer_insert(std::uint64_t at, std::uint64_t period, Task job, 
+            std::function<void()> every) {
+            std::unique_lock<std::mutex> lock(_mutex_timers);
+            if (_timers_closed) return 0;
+            auto id = _timers.insert(at, period, std::move(job), std::move(every));
+            if (!_timers_on) {
+                _timers_on = true;
+                _timer_thread = std::thread(&ThreadPool::_timer_loop, this);
+            } else if (at < _timer_wake) {
+                _timers_cv.notify_one();
+            }
+            return id;
+        }
+
+        /**
+        *   Body of the timer thread: push the expired
+        *   timers in one batch, then sleep until the
+        *   next one.
+        */
+        void
+        _timer_loop() {
+            std::vector<Task> due;
+            std::unique_lock<std::mutex> lock(_mutex_timers);
+            while (_timers_on) {
+                auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - _timer_origin).count() / TP_TIMER_TICK_US;
+                _timers.advance(static_cast<std::uint64_t>(now), due);
+                if (!due.empty()) {
+                    lock.unlock();
+                    _safe_queue_push_bulk(due);
+                    due.clear();
+                    lock.lock();
+                    continue;
+                }
+                _timer_wake = _timers.next();
+                if (_timer_wake == TimerWheel::never) _timers_cv.wait(lock);
+                else {
+                    _timers_cv.wait_until(lock, _timer_origin + 
+                        std::chrono::microseconds(_timer_wake * TP_TIMER_TICK_US));
+                }
+                _timer_wake = 0;
+            }
+        }
+
+        /**
+        *   Stop the timer thread, dropping the 
+        *   pending timers.
+        */
+        void
+        _timers_shutdown() {
+            std::unique_lock<std::mutex> lock(_mutex_timers);
+            _timers_closed = true;
+            if (!_timers_on) return;
+            _timers_on = false;
+            _timers_cv.notify_all();
+            lock.unlock();
+            _timer_thread.join();
+        }
+
+        /**
+        *   Body of the autoscaler thread: samples
+        *   the load every policy.interval and 
+        *   grows or shrinks the pool.
+        */
+        void
+        _autoscale_loop() {
+            typedef std::chrono::steady_clock Clock;
+            int behind = 0, window_busy = 0;
+            auto window_start = Clock::now();
+            auto last = window_start;
+            std::uint64_t last_done = _autoscale_sample(nullptr);
+
+            std::unique_lock<std::mutex> lock(_mutex_autoscale);
+            while (_autoscale_on) {
+                _autoscale_cv.wait_for(lock, _autoscale_policy.interval);
+                if (!_autoscale_on) break;
+                AutoscalePolicy p = _autoscale_policy;
+                lock.unlock();
+
+                int busy = 0;
+                std::uint64_t done = _autoscale_sample(&busy);
+                auto now = Clock::now();
+                double dt = std::chrono::duration<double>(now - last).count();
+                double rate = dt > 0 ? static_cast<double>(done - last_done) / dt : 0;
+                last = now;
+                last_done = done;
+
+                int threads = _threads_count;
+                int queued = std::max(0, static_cast<int>(_push_c) - busy);
+                double wait_s = rate > 0 ? queued / rate : (queued > 0 ? 1e9 : 0);
+                bool is_behind = queued > 0 && (queued >= p.backlog_per_thread * threads ||
+                    wait_s > std::chrono::duration<double>(p.max_queue_wait).count());
+                behind = is_behind ? behind + 1 : 0;
+                window_busy = std::max(window_busy, busy + std::min(queued, threads));
+
+                int target = threads;
+                if (behind >= p.grow_samples && threads < p.max_threads) {
+                    target = threads + std::max(1, std::min(threads, queued));
+                } else if (now - window_start >= p.keep_alive) {
+                    target = window_busy;
+                }
+                target = std::min(p.max_threads, std::max(p.min_threads, target));
+                if (target != threads || now - window_start >= p.keep_alive) {
+                    behind = 0;
+                    window_busy = std::min(target, busy);
+                    window_start = now;
+                }
+                if (target != threads && threads != 0) _autoscale_resize(target);
+                lock.lock();
+            }
+        }
+
+        /**
+        *   Clock of the probes, 0 unless metrics
+        *   or tracing are compiled in.
+        */
+        static std::uint64_t
+        _now_ns() {
+            #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+            #else
+            return 0;
+            #endif
+        }
+
+        /**
+        *   Mark a job entering a queue: the time, 
+        *   and for the trace who pushed it.
+        */
+        static void
+        _stamp(Task &t, Priority p = Priority::Normal) {
+            #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
+            t.enqueued_ns = _now_ns();
+            #endif
+            #if TP_ENABLE_TRACING
+            t.trace_id = _trace_next_id();
+            t.priority = static_cast<std::uint8_t>(p);
+            #endif
+            (void)t; (void)p;
+        }
+
+        /**
+        *   Probes of the thread loop, empty unless
+        *   TP_ENABLE_METRICS or TP_ENABLE_TRACING.
+        *   Idle time runs from the first failed pop
+        *   to the next job.
+        */
+        void
+        _probe_idle(Worker &w) {
+            #if TP_ENABLE_METRICS
+            if (w.metrics.idle_since == 0) w.metrics.idle_since = _now_ns();
+            #endif
+            (void)w;
+        }
+
+        void
+        _probe_parked(Worker &w, std::uint64_t since) {
+            #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
+            auto now = _now_ns();
+            #endif
+            #if TP_ENABLE_METRICS
+            WorkerMetrics::add(w.metrics.parks, 1);
+            WorkerMetrics::add(w.metrics.park_ns, now - since);
+            #endif
+            #if TP_ENABLE_TRACING
+            _trace_write(w, TraceKind::Park, since, now - since, 0, 0, nullptr);
+            #endif
+            (void)w; (void)since;
+        }
+
+        void
+        _probe_stolen(Worker &w) {
+            #if TP_ENABLE_METRICS
+            WorkerMetrics::add(w.metrics.stolen, 1);
+            #endif
+            #if TP_ENABLE_TRACING
+            _trace_write(w, TraceKind::Steal, _now_ns(), 0, 0, 0, nullptr);
+            #endif
+            (void)w;
+        }
+
+        std::uint64_t
+        _probe_resumed(Worker &w) {
+            #if TP_ENABLE_METRICS
+            auto &m = w.metrics;
+            auto now = _now_ns();
+            if (m.idle_since != 0) {
+                WorkerMetrics::add(m.idle_ns, now - m.idle_since);
+                m.idle_since = 0;
+            }
+            return now;
+            #else
+            (void)w;
+            return _now_ns();
+            #endif
+        }
+
+        /**
+        *   What the probes need of the running 
+        *   job, taken before it runs.
+        */
+        struct JobProbe
+        {
+            std::uint64_t started;
+            #if TP_ENABLE_TRACING
+            std::uint64_t enqueued;
+            std::uint64_t id;
+            std::uint64_t tag;
+            const char *label;
+            #endif
+        };
+
+        JobProbe
+        _probe_started(Worker &w, const Task &t) {
+            JobProbe probe;
+            probe.started = _probe_resumed(w);
+            #if TP_ENABLE_METRICS
+            auto &m = w.metrics;
+            if (t.enqueued_ns != 0) {
+                auto waited = probe.started > t.enqueued_ns ? probe.started - t.enqueued_ns : 0;
+                WorkerMetrics::add(m.wait[LatencyHistogram::bucket(waited)], 1);
+            }
+            auto depth = static_cast<std::uint64_t>(std::max(0, static_cast<int>(_push_c)));
+            if (depth > m.depth_max.load(std::memory_order_relaxed)) {
+                m.depth_max.store(depth, std::memory_order_relaxed);
+            }
+            #endif
+            #if TP_ENABLE_TRACING
+            probe.enqueued = t.enqueued_ns;
+            probe.id = t.trace_id;
+            probe.tag = (static_cast<std::uint64_t>(t.group) << 8) | t.priority;
+            probe.label = t.label;
+            #endif
+            (void)t;
+            return probe;
+        }
+
+        void
+        _probe_ran(Worker &w, const JobProbe &probe) {
+            #if TP_ENABLE_METRICS || TP_ENABLE_TRACING
+            auto ran = _now_ns() - probe.started;
+            #endif
+            #if TP_ENABLE_METRICS
+            WorkerMetrics::add(w.metrics.run[LatencyHistogram::bucket(ran)], 1);
+            #endif
+            #if TP_ENABLE_TRACING
+            _trace_write(w, TraceKind::Task, probe.started, ran, 
+                probe.enqueued, probe.id, probe.label, probe.tag);
+            #endif
+            (void)w; (void)probe;
+        }
+
+        #if TP_ENABLE_TRACING
+        /**
+        *   Small ids of the threads in the trace,
+        *   of the pools, and of the pushed jobs 
+        *   [the pusher in the high bits].
+        */
+        static std::uint32_t
+        _trace_tid() {
+            static std::atomic<std::uint32_t> next{0};
+            static thread_local std::uint32_t tid = ++next;
+            return tid;
+        }
+
+        static std::uint32_t
+        _trace_new_pid() {
+            static std::atomic<std::uint32_t> next{0};
+            return ++next;
+        }
+
+        static std::uint64_t
+        _trace_next_id() {
+            static thread_local std::uint64_t seq = 0;
+            return (static_cast<std::uint64_t>(_trace_tid()) << 40) | 
+                (++seq & ((std::uint64_t(1) << 40) - 1));
+        }
+
+        void
+        _trace_write(Worker &w, TraceKind kind, std::uint64_t ts, std::uint64_t dur,
+            std::uint64_t aux, std::uint64_t id, const char *label, std::uint64_t tag = 0) {
+            if (!_tracer->on.load(std::memory_order_relaxed)) return;
+            auto r = w.trace.load(std::memory_order_acquire);
+            if (r) r->write(kind, _trace_tid(), ts, dur, aux, id, tag, label);
         }
 
         /**
-        *   Create a new group, insert a job on it
-        *   and dispatch it.
-        *   It is guaranteed that this job will be
-        *   the first next job to be processed by
-        *   the threadpool.
+        *   The time in microseconds from the start
+        *   of the trace, with the ns as decimals.
         */
-        template<class F> void
-        dg_now(const std::string& id, F&& f) noexcept(false) {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_not_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            _groups.insert(std::make_pair(id, DispatchGroup(id)));
-            it = _groups.find(id);
-            it->second.insert(f);
-            it->second.leave();
-            _safe_queue_push_front(it->second.jobs()[0]);
+        static void
+        _trace_ts(std::ostream &os, std::uint64_t ns) {
+            auto r = ns % 1000;
+            os << ns / 1000 << '.' << static_cast<char>('0' + r / 100) 
+                << static_cast<char>('0' + r / 10 % 10) << static_cast<char>('0' + r % 10);
         }
 
-        /**
-        *   Signal to a group that the jobs immission 
-        *   is end, than start pushing the group jobs
-        *   to the standard threadpool queue. At the end
-        *   of the tasks, it will execute the f action,
-        *   like a barrier.
-        */
-        template<class F> void
-        dg_close_with_barrier(const std::string &id, const F&& f) noexcept(false) {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            it->second.leave(f);
-            auto jobs = it->second.jobs();
-            for (auto &j : jobs) { push(j); }
+        static void
+        _trace_escape(std::ostream &os, const std::string &str) {
+            for (char c : str) {
+                if (c == '"' || c == '\\') os << '\\' << c;
+                else if (static_cast<unsigned char>(c) < 0x20) os << ' ';
+                else os << c;
+            }
         }
 
         /**
-        *   Signal to a group that the jobs immission 
-        *   is end, than start pushing the group jobs
-        *   to the standard threadpool queue.
+        *   Write the opening of an event, the 
+        *   caller appends its own fields.
         */
-        void
-        dg_close(const std::string& id) noexcept(false) {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            it->second.leave();
-            auto jobs = it->second.jobs();
-            for (auto &j : jobs) { push(j); }
+        static void
+        _trace_head(std::ostream &os, const std::string &name, const char *cat, const char *ph,
+            std::uint32_t pid, std::uint32_t tid, std::uint64_t ts) {
+            os << ",\n{\"name\":\"";
+            _trace_escape(os, name);
+            os << "\",\"cat\":\"" << cat << "\",\"ph\":\"" << ph << "\",\"pid\":" << pid 
+                << ",\"tid\":" << tid << ",\"ts\":";
+            _trace_ts(os, ts);
         }
 
         /**
-        *   Wait until every job in a group is computed.
-        *   This is a thread blocking call.
+        *   Chrome trace event format: a job is a 
+        *   complete event, with a flow arrow from 
+        *   an instant event where it was pushed; a
+        *   sleep is a complete event; steals and 
+        *   groups are instant events.
         */
-        void
-        dg_wait(const std::string &id) noexcept(false) {
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            while(!it->second.has_finished()) {
-                std::chrono::nanoseconds(0); 
+        static void
+        _trace_json(std::ostream &os, const std::vector<TraceRecord> &events,
+            std::uint32_t pid, std::uint64_t since) {
+            std::vector<std::uint32_t> workers;
+            os << "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+                << ",\"tid\":0,\"args\":{\"name\":\"ThreadPool " << pid << "\"}}";
+            for (auto &e : events) {
+                if (e.ts < since) continue;
+                auto ts = e.ts - since;
+                switch (e.kind) {
+                case TraceKind::Task:
+                    _trace_head(os, e.label ? e.label : "task", "task", "X", pid, e.tid, ts);
+                    os << ",\"dur\":";
+                    _trace_ts(os, e.dur);
+                    os << ",\"args\":{\"priority\":" << (e.tag & 0xff);
+                    if (e.tag >> 8) os << ",\"group\":" << (e.tag >> 8);
+                    if (e.aux != 0 && e.aux <= e.ts) {
+                        os << ",\"queued_us\":";
+                        _trace_ts(os, e.ts - e.aux);
+                    }
+                    os << "}}";
+                    if (e.id != 0 && e.aux >= since && e.aux <= e.ts) {
+                        auto from = static_cast<std::uint32_t>(e.id >> 40);
+                        _trace_head(os, "push", "task", "i", pid, from, e.aux - since);
+                        os << ",\"s\":\"t\"}";
+                        _trace_head(os, "queued", "task", "s", pid, from, e.aux - since);
+                        os << ",\"id\":" << e.id << "}";
+                        _trace_head(os, "queued", "task", "f", pid, e.tid, ts);
+                        os << ",\"bp\":\"e\",\"id\":" << e.id << "}";
+                    }
+                    break;
+                case TraceKind::Park:
+                    _trace_head(os, "park", "idle", "X", pid, e.tid, ts);
+                    os << ",\"dur\":";
+                    _trace_ts(os, e.dur);
+                    os << "}";
+                    break;
+                case TraceKind::Steal:
+                    _trace_head(os, "steal", "steal", "i", pid, e.tid, ts);
+                    os << ",\"s\":\"t\"}";
+                    break;
+                default:
+                    _trace_head(os, e.kind == TraceKind::GroupOpen ? "dg_open" :
+                        e.kind == TraceKind::GroupClose ? "dg_close" : "dg_finish",
+                        "group", "i", pid, e.tid, ts);
+                    os << ",\"s\":\"t\",\"args\":{\"group\":\"";
+                    _trace_escape(os, e.group);
+                    os << "\",\"handle\":" << e.aux << "}}";
+                    continue;
+                }
+                workers.push_back(e.tid);
             }
-            _groups.erase(it);
+            std::sort(workers.begin(), workers.end());
+            workers.erase(std::unique(workers.begin(), workers.end()), workers.end());
+            for (auto tid : workers) {
+                os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" 
+                    << tid << ",\"args\":{\"name\":\"worker " << tid << "\"}}";
+            }
+            os << "\n],\"displayTimeUnit\":\"ns\"}\n";
         }
+        #endif
 
         /**
-        *   Wait until every job in a group is computed.
-        *   This is a thread blocking call. 
-        *   At the end execute the callback;
+        *   Counters of a worker, read while it runs.
         */
-        template<class F> void
-        dg_wait(const std::string &id, F&& f) noexcept(false) {
-            #if TP_ENABLE_SANITY_CHECKS
-                try {
-                    dg_wait(id);
-                    f();
-                } catch(std::runtime_error e) {
-                    throw e;
-                } catch(...) {
-                    throw;
-                }
-            #else
-                dg_wait(id);
-                try {
-                    f();
-                } catch(...) {
-                    throw;
-                }
+        static ThreadStats
+        _worker_stats(const Worker &w) {
+            ThreadStats st;
+            st.executed = w.done.load(std::memory_order_relaxed);
+            #if TP_ENABLE_METRICS
+            auto &m = w.metrics;
+            st.stolen = m.stolen.load(std::memory_order_relaxed);
+            st.parks = m.parks.load(std::memory_order_relaxed);
+            st.idle_ns = m.idle_ns.load(std::memory_order_relaxed);
+            st.park_ns = m.park_ns.load(std::memory_order_relaxed);
             #endif
+            return st;
         }
-        
+
+        #if TP_ENABLE_METRICS
+        static void
+        _worker_histograms(const Worker &w, LatencyHistogram &wait, LatencyHistogram &run) {
+            for (int i = 0; i < TP_METRICS_BUCKETS; ++i) {
+                wait.buckets[i] += w.metrics.wait[i].load(std::memory_order_relaxed);
+                run.buckets[i] += w.metrics.run[i].load(std::memory_order_relaxed);
+            }
+        }
+        #endif
+
         /**
-        *   The same as synchronize, but is useful
-        *   if you don't want do block all others
-        *   jobs in the queue.
+        *   Jobs run so far by the pool threads,
+        *   and how many of them are running one.
         */
-        void
-        dg_synchronize(const std::string &id) noexcept(false)  {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            it->second.synchronize();
-        }
-        /**/
-        void
-        dg_end_synchronize(const std::string id) noexcept(false)  {
-            std::unique_lock<std::mutex> lock(_mutex_groups);
-            std::map<std::string, DispatchGroup>::iterator it;
-            if (!_unsafe_dg_id_check(id, it)) {
-                #if TP_ENABLE_SANITY_CHECKS
-                    throw std::runtime_error(errors.dg_empty(id));
-                #else
-                    return;
-                #endif
-            }   
-            it->second.end_synchronize();
+        std::uint64_t
+        _autoscale_sample(int *busy) {
+            std::unique_lock<std::mutex> lock(_mutex_pool);
+            std::uint64_t done = _retired_stats.executed;
+            for (auto &w : _workers) {
+                done += w->done.load(std::memory_order_relaxed);
+                if (busy && w->busy.load(std::memory_order_relaxed)) ++*busy;
+            }
+            return done;
         }
 
         /**
-        *   Set a callback for excpetion handling.
-        *   If not setted, threadpool has a default
-        *   callback, that does nothing and not
-        *   rethrow.
+        *   resize() on behalf of the autoscaler,
+        *   skipped if the pool was stopped.
         */
-        template<class F> void
-        set_excpetion_action(std::function<void(F)> f) {
-            auto func = [&f] (std::exception_ptr excp) {
-                try { std::rethrow_exception(excp);
-                } catch(F e) { f(e); }
-            };
+        void
+        _autoscale_resize(int num_threads) {
             _sem_api.wait();
-            _exception_action = func;
+            if (_run_pool_thread && _threads_count != 0) {
+                while (_threads_count < num_threads) _safe_thread_push();
+                while (_threads_count > num_threads) _safe_thread_pop();
+            }
             _sem_api.signal();
         }
 
-        /**  
-        *    ____       _            _       
-        *   |  _ \ _ __(_)_   ____ _| |_ ___ 
-        *   | |_) | '__| \ \ / / _` | __/ _ \
-        *   |  __/| |  | |\ V / (_| | ||  __/
-        *   |_|   |_|  |_| \_/ \__,_|\__\___|
-        *
-        */                                    
-    private:
-        /** 
-        *   Mutex for queue access. 
-        */
-        std::mutex _mutex_queue;
-        /** 
-        *   Mutex for pool resize. 
-        */
-        std::mutex _mutex_pool;
-        /** 
-        *   Mutex for groups access. 
-        */
-        std::mutex _mutex_groups;
-        /** 
-        *   Semaphore for class thread-safety. 
-        */
-        Semaphore _sem_api;
-        /**
-        *   Optional semaphore for jobs lambda data
-        *   protection in critical sections.
-        */
-        Semaphore _sem_job_ins_container;
-        /** 
-        *   Time in nanoseconds which threads
-        *   that are sleeping check for new
-        *   jobs in the queue.
-        */
-        std::atomic<int> _thread_sleep_time_ns;
-        /**
-        *   Flag for pool's threads state,
-        *   when false, all the threads will be
-        *   detached.
-        */
-        std::atomic<bool> _run_pool_thread;
-        /** 
-        *   Where the running threads lives. 
-        */
-        std::vector<std::thread> _pool;
-        /** 
-        *   Queue of jobs to do.
-        */
-        std::deque<std::function<void()> > _queue;
-        /** 
-        *   A map of in process groups of jobs.
-        */
-        std::map<std::string, DispatchGroup> _groups;
-        /** 
-        *   The number of threads currently in the pool.
-        */
-        std::atomic<int> _threads_count;
-        /** 
-        *   Counter used when there are 
-        *   some threads to remove from
-        *   the pool [stop or resize]. 
-        */
-        std::atomic<int> _thread_to_kill_c;
-        /** 
-        *   Stores the id's of the threads
-        *   that will be kills.
-        */
-        std::vector<std::thread::id> _threads_to_kill_id;
-        /** 
-        *   When zero means that all the task
-        *   were executed and no one is 
-        *   waiting.
-        */
-        std::atomic<int> _push_c;
-        /**
-        *   Number of threads that the pool had
-        *   when a stop() was called. Used
-        *   by the awake() method to restore the 
-        *   same number of threads.
-        */
-        std::atomic<int> _prev_threads;
         /**
-        *   Callback for excpetion handling setted by the user.
+        *   Spin for a while before sleeping, and
+        *   return true if some work showed up.
+        *   The spin length adapts to how often 
+        *   spinning paid off for this thread.
         */
-        std::function<void(std::exception_ptr)> _exception_action; 
-        std::mutex _mutex_exceptions;
+        bool
+        _spin_for_work(Worker &w) {
+            int budget = _spin_budget;
+            if (budget <= 0) return false;
+            int floor = std::max(1, budget / 16);
+            if (w.spin < 0) w.spin = budget;
+            int limit = std::max(floor, std::min(w.spin, budget));
+            bool found = false;
+            _threads_blocker.spin_begin();
+            for (int i = 1; i <= limit; ++i) {
+                cpu_relax();
+                if ((i & 7) != 0) continue;
+                if (w.retire.load(std::memory_order_relaxed)) break;
+                if (_has_work(w)) {
+                    found = true;
+                    break;
+                }
+            }
+            _threads_blocker.spin_end();
+            w.spin = found ? std::min(budget, limit * 2) : std::max(floor, limit / 2);
+            return found;
+        }
+
         /**
-        *   Manage the threads waiting.
+        *   Run a popped job. The job is destroyed
+        *   by the caller, after the counters have
+        *   been updated [see LatchJob].
         */
-        ThreadsBlocker _threads_blocker;
+        void
+        _run_job(Task &t) {
+            _call_job(t);
+            _job_done();
+        }
+
+        void
+        _call_job(Task &t) {
+            try {
+                t();
+            } catch (...) {
+                std::unique_lock<std::mutex> lock(_mutex_exceptions);
+                _exc_exception_action(std::current_exception());
+            }
+        }
+
         /**
-        *   For speedup.
+        *   Count a job as done, after its probes 
+        *   have been recorded: what wait() sees 
+        *   done is in stats() and the traces.
         */
-        bool _queue_empty = true;
+        void
+        _job_done() {
+            if (--_push_c == 0) _jobs_done_ec.notify_all();
+            _space_ec.notify_all();
+        }
 
         /**
-        *   String errors that are throw when user 
-        *   submit wrong inputs or try to do illegal
-        *   operations.
+        *   Run jobs of the pool on the calling
+        *   thread until done() is true or there
+        *   is nothing to pop. Used by Future::get,
+        *   the nesting is bounded to keep the 
+        *   stack small.
         */
-        struct Errors 
-        {            
-            std::string 
-            dg_empty(const std::string& id) {
-                return "ThreadPool: group with id " + id + " not exist";
-            };
-            
-            std::string 
-            dg_not_empty(const std::string& id) {
-                return "ThreadPool: group with id " + id + " already exist";
-            };
-            
-            std::string sleep_time = 
-                "ThreadPool: sleep time value must be greater or equal to zero";
-            
-            std::string apply_it_num =
-                "ThreadPool: Number of iterations in apply must be greater than zero";
-            
-            std::string resize_alloc = 
-                "ThreadPool: Number of threads in resize or alloc must be greater than zero";
-        } errors;
+        template<class P> void
+        _help_until(P&& done) {
+            auto &ctx = _this_thread();
+            if (ctx.help_depth >= 16) return;
+            ++ctx.help_depth;
+            while (!done()) {
+                Task t;
+                if (ctx.pool == this && ctx.worker) t = _pop_job(*ctx.worker);
+                else if (_mode == QueueMode::RingBuffer) t = _ring_pop();
+                else t = _safe_queue_pop();
+                if (!t && _node_c != 0) t = _node_steal(0);
+                if (!t) break;
+                _run_job(t);
+            }
+            --ctx.help_depth;
+        }
+
+    }; /* End ThreadPool */
+
+    /**
+    *   Result type of a continuation of a
+    *   Future<T>: f(T), or f() for void.
+    */
+    template<class F, class T> struct ThenResult
+    {
+        typedef decltype(std::declval<F&>()(std::declval<T>())) type;
+    };
+
+    template<class F> struct ThenResult<F, void>
+    {
+        typedef decltype(std::declval<F&>()()) type;
+    };
+
+    /**
+    *   Compute the value of a continuation 
+    *   from the value of its predecessor. An
+    *   exception of the predecessor is 
+    *   forwarded without calling f.
+    */
+    template<class T, class R> struct ThenCall
+    {
+        template<class F> static void
+        run(FutureState<T>& prev, FutureState<R>& next, F& f) {
+            FutureFulfill<R>::run(next, f, prev.take());
+        }
+    };
+
+    template<class R> struct ThenCall<void, R>
+    {
+        template<class F> static void
+        run(FutureState<void>& prev, FutureState<R>& next, F& f) {
+            prev.take();
+            FutureFulfill<R>::run(next, f);
+        }
+    };
+
+    /**
+    *   Continuation registered on a FutureState:
+    *   when the predecessor is ready it pushes
+    *   itself to the pool, where it computes 
+    *   the next value.
+    */
+    template<class F, class T, class R> struct ThenJob
+    {
+        ThenJob(F&& f, std::shared_ptr<FutureState<T> > p, 
+            std::shared_ptr<FutureState<R> > n, ThreadPool *tp) : 
+            func(std::move(f)), prev(std::move(p)), next(std::move(n)), 
+            pool(tp), scheduled(false) {};
+        ThenJob(const F& f, std::shared_ptr<FutureState<T> > p, 
+            std::shared_ptr<FutureState<R> > n, ThreadPool *tp) : 
+            func(f), prev(std::move(p)), next(std::move(n)), 
+            pool(tp), scheduled(false) {};
+        ThenJob(ThenJob&& J) noexcept : 
+            func(std::move(J.func)), prev(std::move(J.prev)), next(std::move(J.next)), 
+            pool(J.pool), scheduled(J.scheduled) {};
+        ThenJob(const ThenJob&) = delete;
+        ~ThenJob() {
+            if (next) next->set_exception(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+        }
+
+        void
+        operator()() {
+            if (!scheduled) {
+                scheduled = true;
+                pool->_safe_queue_push(Task(std::move(*this)));
+                return;
+            }
+            std::shared_ptr<FutureState<R> > n(std::move(next));
+            std::shared_ptr<FutureState<T> > p(std::move(prev));
+            if (!n->start()) return;
+            try {
+                ThenCall<T, R>::run(*p, *n, func);
+            } catch(...) {
+                n->set_exception(std::current_exception());
+            }
+        }
 
-        /**
-        *   Given a condition to check, throw an error
-        *   if the condition is true.
-        */
-        template<class M, class T> void 
-        _condition_check(M&& m, T&& t) noexcept(false) {
-            if (t()) throw std::runtime_error(m);
+        bool
+        cancelled() const {
+            return next && next->cancelled();
         }
 
-        /**
-        *   Check if the groups map contains or
-        *   not the required id. Used
-        *   by dispatch_group methods.
-        */
+        F func;
+        std::shared_ptr<FutureState<T> > prev;
+        std::shared_ptr<FutureState<R> > next;
+        ThreadPool *pool;
+        bool scheduled;
+    };
+
+    /**
+    *   Future returned by future_from_push.
+    *   Like std::future it is move only and
+    *   its value can be taken once, with get() 
+    *   or by a continuation added with then().
+    */
+    template<class T> class Future
+    {
+    public:
+        Future() : _pool(nullptr) {};
+        Future(std::shared_ptr<FutureState<T> > s, ThreadPool *tp) : 
+            _state(std::move(s)), _pool(tp) {};
+        Future(Future&& F) noexcept : 
+            _state(std::move(F._state)), _pool(F._pool) {};
+        Future& operator = (Future&& F) noexcept {
+            _state = std::move(F._state);
+            _pool = F._pool;
+            return *this;
+        }
+        Future(const Future&) = delete;
+        Future& operator = (const Future&) = delete;
+        ~Future() {};
+
         bool
-        _unsafe_dg_id_check(const std::string &id, 
-            std::map<std::string, DispatchGroup>::iterator& it) {
-            it = _groups.find(id);
-            return (it == _groups.end()) ? false : true;
+        valid() const {
+            return _state != nullptr;
         }
 
-        /**
-        *   Called by pools threads when
-        *   an excpetion occours.
-        */
-        template<class F> void
-        _exc_exception_action(F excpetion) {
-            _exception_action(excpetion);
+        bool
+        is_ready() const {
+            return _state && _state->is_ready();
         }
 
-        /**
-        *   Lock the queue mutex for
-        *   a safe insertion in the queue.
-        */
-        template<class F> void
-        _safe_queue_push(F&& t) {
-            ++_push_c;
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            _queue.push_back(std::move(t));
-            if (_queue_empty) _threads_blocker.unblock();
+        void
+        wait() const {
+            _state->wait();
         }
 
-        /**
-        *   Modify the queue in UNSAFE 
-        *   manner, so you should lock
-        *   the queue outside this function.
-        */
-        template<class F> void
-        _unsafe_queue_push(F&& t) {
-            ++_push_c;
-            _queue.push_back(std::move(t));
-            if (_queue_empty) _threads_blocker.unblock();
+        template<class Rep, class Per> std::future_status
+        wait_for(const std::chrono::duration<Rep, Per>& d) const {
+            return wait_until(std::chrono::steady_clock::now() + d);
+        }
+
+        template<class C, class D> std::future_status
+        wait_until(const std::chrono::time_point<C, D>& t) const {
+            return _state->wait_until(t) ? 
+                std::future_status::ready : std::future_status::timeout;
         }
 
         /**
-        *   Modify the queue in UNSAFE 
-        *   manner, so you should lock
-        *   the queue outside this function.
-        *   Used for push with variadic templates.
+        *   Cancel the job computing the value if it
+        *   has not started: the pool drops it and 
+        *   get() throws std::runtime_error. Return
+        *   false if the job started or the value is
+        *   ready. The future stays valid.
         */
-        template<class F, class... Args> void
-        _unsafe_queue_push(F&& t, Args... args) {
-            ++_push_c;
-            _queue.push_back(std::move(t));
-            _unsafe_queue_push(args...);
-            if (_queue_empty) _threads_blocker.unblock();
+        bool
+        cancel() {
+            return _state && _state->cancel();
         }
 
         /**
-        *   Lock the queue mutex for
-        *   a safe insertion in the queue.
-        *   Insert the element at end of the 
-        *   queue.
+        *   Wait and return the value, or rethrow
+        *   the exception of the job. While the value
+        *   is not ready, the caller runs the queued
+        *   jobs of the pool instead of sleeping.
+        *   The future is no more valid after.
         */
-        template<class F> void
-        _safe_queue_push_front(F&& t) {
-            ++_push_c;
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            _queue.push_front(std::move(t));
-            if (_queue_empty) _threads_blocker.unblock();
+        T
+        get() noexcept(false) {
+            std::shared_ptr<FutureState<T> > s(std::move(_state));
+            if (_pool && !s->is_ready()) {
+                _pool->_help_until([&s]() { return s->is_ready(); });
+            }
+            return s->take();
         }
 
         /**
-        *   Modify the queue in UNSAFE 
-        *   manner, so you should lock
-        *   the queue outside this function.
-        *   Insert the element at end of the 
-        *   queue.
+        *   Push f to the pool when this future is
+        *   ready: f receives the value [nothing for
+        *   void] and its result is in the returned
+        *   future. An exception skips f and reaches
+        *   the returned future. This future is no
+        *   more valid after.
         */
-        template<class F> void
-        _unsafe_queue_push_front(F&& t) {
-            ++_push_c;
-            _queue.push_front(std::move(t));
-            if (_queue_empty) _threads_blocker.unblock();
+        template<class F> Future<typename ThenResult<typename std::decay<F>::type, T>::type>
+        then(F&& f) {
+            typedef typename std::decay<F>::type Fn;
+            typedef typename ThenResult<Fn, T>::type R;
+            std::shared_ptr<FutureState<R> > next = 
+                std::allocate_shared<FutureState<R> >(PoolAllocator<FutureState<R> >());
+            std::shared_ptr<FutureState<T> > prev(std::move(_state));
+            prev->on_ready(Task(ThenJob<Fn, T, R>(std::forward<F>(f), prev, next, _pool)));
+            return Future<R>(std::move(next), _pool);
         }
 
+        #if TP_ENABLE_COROUTINES
         /**
-        *   Lock the queue mutex, safely pop
-        *   job from the queue if not empty.
+        *   co_await on a future suspends the 
+        *   coroutine until the value is ready, than
+        *   resumes it on the pool [or inline if the
+        *   future has no pool]. The future is
+        *   consumed.
         */
-        std::function<void()>
-        _safe_queue_pop() {
-            std::unique_lock<std::mutex> lock(_mutex_queue);
-            if (_queue.empty()) {
-                _queue_empty = true;
-                return std::function<void()>();
-            } 
+        struct Awaiter
+        {
+            std::shared_ptr<FutureState<T> > state;
+            ThreadPool *pool;
 
-            auto t = _queue.front();
-            _queue.pop_front();
-            _queue_empty = false; 
-            return t;
+            bool await_ready() const noexcept { return state->is_ready(); }
+
+            void
+            await_suspend(std::coroutine_handle<> h) {
+                std::shared_ptr<FutureState<T> > s(state);
+                ThreadPool *p = pool;
+                s->on_ready(Task([p, h]() {
+                    if (p) p->_safe_queue_push(Task([h]() { h.resume(); }));
+                    else h.resume();
+                }));
+            }
+
+            T await_resume() { return state->take(); }
+        };
+
+        Awaiter
+        operator co_await() && {
+            return Awaiter{ std::move(_state), _pool };
         }
 
-        /**
-        *   Called when the ThreadPool is created 
-        *   or the user has required a resize 
-        *   operation.
-        */
+        Awaiter
+        operator co_await() & {
+            return Awaiter{ std::move(_state), _pool };
+        }
+        #endif
+
+    private:
+        friend struct FutureCombine;
+        std::shared_ptr<FutureState<T> > _state;
+        ThreadPool *_pool;
+    };
+
+    /**
+    *   Result of when_all and when_any: the values
+    *   in order, or the index and the value of the
+    *   first ready future; void inputs give void
+    *   and the index.
+    */
+    template<class T> struct WhenAllResult { typedef std::vector<T> type; };
+    template<> struct WhenAllResult<void> { typedef void type; };
+    template<class T> struct WhenAnyResult { typedef std::pair<size_t, T> type; };
+    template<> struct WhenAnyResult<void> { typedef size_t type; };
+
+    /**
+    *   State of a when_all: each input stores
+    *   its value in its slot, the last one 
+    *   builds the result.
+    */
+    template<class T> struct WhenAllState
+    {
+        typedef typename WhenAllResult<T>::type R;
+
+        WhenAllState(size_t n) : 
+            values(new FutureStorage<T>[n]), 
+            size(n),
+            remaining(n),
+            failed(false) {};
+
+        void
+        store(size_t i, FutureState<T>& in) {
+            values[i].set(in.take());
+        }
+
+        void
+        finish() {
+            R v;
+            v.reserve(size);
+            for (size_t i = 0; i < size; ++i) v.push_back(values[i].take());
+            result->set_value(std::move(v));
+        }
+
+        std::unique_ptr<FutureStorage<T>[]> values;
+        size_t size;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+        std::shared_ptr<FutureState<R> > result;
+    };
+
+    template<> struct WhenAllState<void>
+    {
+        WhenAllState(size_t n) : remaining(n), failed(false) {};
+
         void 
-        _safe_thread_push() {
-            std::unique_lock<std::mutex> lock(_mutex_pool);
-            _pool.push_back(std::thread(&ThreadPool::_thread_loop_mth, this));
-            ++_threads_count;
+        store(size_t, FutureState<void>& in) { 
+            in.take(); 
         }
 
-        /**
-        *   Called when the ThreadPool is deleted 
-        *   or the user has required both a resize 
-        *   operation or a stop operation.
-        */
         void 
-        _safe_thread_pop() {
-            std::unique_lock<std::mutex> lock(_mutex_pool);
-            if (_pool.empty()) return; 
-            
-            ++_thread_to_kill_c;
-            _threads_to_kill_id.push_back(_pool.back().get_id());
-            _pool.back().detach();
-            _pool.pop_back();
-            --_threads_count;  
+        finish() { 
+            result->set_value(); 
         }
 
-        /**
-        *   Called by each thread in the pool
-        *   when _thread_to_kill_c != 0.
-        *   Than the thread will know if must 
-        *   exit from the loop.
-        */
-        bool
-        _thread_is_to_kill(std::thread::id id) {
-            std::unique_lock<std::mutex> lock(_mutex_pool);
-            std::vector<std::thread::id>::iterator it = std::find_if(_threads_to_kill_id.begin(), 
-                _threads_to_kill_id.end(), [id](std::thread::id tid) { return (tid == id); });
-            return (it == _threads_to_kill_id.end()) ? false : true; 
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+        std::shared_ptr<FutureState<void> > result;
+    };
+
+    /**
+    *   Set the result of a when_any.
+    */
+    template<class T> struct WhenAnyCall
+    {
+        static void
+        run(FutureState<std::pair<size_t, T> >& r, size_t i, FutureState<T>& in) {
+            r.set_value(std::make_pair(i, in.take()));
         }
+    };
 
-        /**
-        *   Each thread start run this function
-        *   when the thread is created, and 
-        *   exit only when the pool is destructed
-        *   or the stop() function is called.
-        *   The thread go to sleep if the 
-        *   queue is empty. 
-        */
-        void 
-        _thread_loop_mth() {
-            Semaphore sem(0);
-            while(_run_pool_thread) {
-                if (_thread_to_kill_c != 0) {
-                    if (_thread_is_to_kill(std::this_thread::get_id())) break;
-                }
-                auto funcf = _safe_queue_pop();
-                if (!funcf) {
-                    if (_threads_blocker.thread_wait(&sem)) sem.wait();    
-                    continue; 
-                }
-                try {
-                    funcf();
-                } catch (...) {
-                    std::unique_lock<std::mutex> lock(_mutex_exceptions);
-                    _exc_exception_action(std::current_exception());
-                }
-                --_push_c;
+    template<> struct WhenAnyCall<void>
+    {
+        static void
+        run(FutureState<size_t>& r, size_t i, FutureState<void>& in) {
+            in.take();
+            r.set_value(i);
+        }
+    };
+
+    /**
+    *   Implementation of the combinators: the
+    *   inputs are observed through continuations
+    *   run by the thread that completes them,
+    *   no pool thread is blocked.
+    */
+    struct FutureCombine
+    {
+        template<class T> static Future<typename WhenAllResult<T>::type>
+        all(std::vector<Future<T> >& in) {
+            typedef typename WhenAllResult<T>::type R;
+            ThreadPool *pool = in.empty() ? nullptr : in[0]._pool;
+            std::shared_ptr<WhenAllState<T> > all = 
+                std::make_shared<WhenAllState<T> >(in.size());
+            all->result = std::allocate_shared<FutureState<R> >(PoolAllocator<FutureState<R> >());
+            Future<R> out(all->result, pool);
+            if (in.empty()) {
+                all->finish();
+                return out;
+            }
+            for (size_t i = 0; i < in.size(); ++i) {
+                std::shared_ptr<FutureState<T> > s(std::move(in[i]._state));
+                FutureState<T> *raw = s.get();
+                raw->on_ready(Task([all, s, i]() {
+                    try {
+                        if (!all->failed) all->store(i, *s);
+                    } catch(...) {
+                        all->failed = true;
+                        all->result->set_exception(std::current_exception());
+                    }
+                    if (--all->remaining == 0 && !all->failed) all->finish();
+                }));
             }
-            --_thread_to_kill_c;
+            return out;
         }
 
-    }; /* End ThreadPool */
+        template<class T> static Future<typename WhenAnyResult<T>::type>
+        any(std::vector<Future<T> >& in) noexcept(false) {
+            typedef typename WhenAnyResult<T>::type R;
+            #if TP_ENABLE_SANITY_CHECKS
+            if (in.empty()) throw std::runtime_error("ThreadPool: when_any needs at least one future");
+            #else
+            if (in.empty()) return Future<R>();
+            #endif
+            std::shared_ptr<FutureState<R> > result = 
+                std::allocate_shared<FutureState<R> >(PoolAllocator<FutureState<R> >());
+            std::shared_ptr<std::atomic<bool> > done = std::make_shared<std::atomic<bool> >(false);
+            Future<R> out(result, in[0]._pool);
+            for (size_t i = 0; i < in.size(); ++i) {
+                std::shared_ptr<FutureState<T> > s(std::move(in[i]._state));
+                FutureState<T> *raw = s.get();
+                raw->on_ready(Task([result, done, s, i]() {
+                    if (done->exchange(true)) return;
+                    try {
+                        WhenAnyCall<T>::run(*result, i, *s);
+                    } catch(...) {
+                        result->set_exception(std::current_exception());
+                    }
+                }));
+            }
+            return out;
+        }
+    };
+
+    /**
+    *   Future of the values of all the *futures*,
+    *   in the same order. The first exception
+    *   is forwarded. The inputs are consumed.
+    */
+    template<class T> Future<typename WhenAllResult<T>::type>
+    when_all(std::vector<Future<T> > futures) {
+        return FutureCombine::all(futures);
+    }
+
+    /**
+    *   Future of the index and the value of the
+    *   first of the *futures* to be ready [an 
+    *   exception if it failed]. The inputs are
+    *   consumed.
+    */
+    template<class T> Future<typename WhenAnyResult<T>::type>
+    when_any(std::vector<Future<T> > futures) noexcept(false) {
+        return FutureCombine::any(futures);
+    }
+
+    #if TP_ENABLE_COROUTINES
+    /**
+    *    _            _    
+    *   | |_ __ _ ___| | __
+    *   | __/ _` / __| |/ /
+    *   | || (_| \__ \   < 
+    *    \__\__,_|___/_|\_\
+    *
+    *
+    *   Promise of task<T>: the coroutine starts
+    *   suspended, and at the end transfers the
+    *   control to the coroutine that awaits it.
+    */
+    struct TaskPromiseBase
+    {
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template<class P> std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<P> h) noexcept {
+                std::coroutine_handle<> c = h.promise().continuation;
+                if (c) return c;
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+    };
+
+    template<class T> struct TaskPromise : TaskPromiseBase
+    {
+        task<T> get_return_object() noexcept;
+
+        template<class U> void
+        return_value(U&& u) {
+            value.emplace(std::forward<U>(u));
+        }
+
+        T
+        take() {
+            if (error) std::rethrow_exception(error);
+            return std::move(*value);
+        }
+
+        std::optional<T> value;
+    };
+
+    template<> struct TaskPromise<void> : TaskPromiseBase
+    {
+        task<void> get_return_object() noexcept;
+
+        void return_void() noexcept {}
+
+        void
+        take() {
+            if (error) std::rethrow_exception(error);
+        }
+    };
+
+    /**
+    *   Lazy coroutine returning T: it starts when
+    *   it is awaited, on the thread of the awaiter,
+    *   and resumes the awaiter when it ends. 
+    *   Use co_await tp.schedule() inside it to
+    *   move on the pool, and ThreadPool::spawn 
+    *   to start it from normal code.
+    */
+    template<class T = void> class task
+    {
+    public:
+        typedef TaskPromise<T> promise_type;
+
+        task(task&& t) noexcept : _h(t._h) { t._h = nullptr; };
+        task& operator = (task&& t) noexcept {
+            if (this != &t) {
+                if (_h) _h.destroy();
+                _h = t._h;
+                t._h = nullptr;
+            }
+            return *this;
+        }
+        task(const task&) = delete;
+        task& operator = (const task&) = delete;
+        ~task() { 
+            if (_h) _h.destroy(); 
+        }
+
+        bool await_ready() const noexcept { return !_h || _h.done(); }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<> awaiter) noexcept {
+            _h.promise().continuation = awaiter;
+            return _h;
+        }
+
+        T await_resume() { return _h.promise().take(); }
+
+    private:
+        friend struct TaskPromise<T>;
+        explicit task(std::coroutine_handle<promise_type> h) : _h(h) {};
+        std::coroutine_handle<promise_type> _h;
+    };
+
+    template<class T> task<T>
+    TaskPromise<T>::get_return_object() noexcept {
+        return task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+    }
+
+    inline task<void>
+    TaskPromise<void>::get_return_object() noexcept {
+        return task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+    }
+    #endif
+
+    /**
+    *       _    _                  _ _   _                   
+    *      / \  | | __ _  ___  _ __(_) |_| |__  _ __ ___  ___ 
+    *     / _ \ | |/ _` |/ _ \| '__| | __| '_ \| '_ ` _ \/ __|
+    *    / ___ \| | (_| | (_) | |  | | |_| | | | | | | | \__ \
+    *   /_/   \_\_|\__, |\___/|_|  |_|\__|_| |_|_| |_| |_|___/
+    *              |___/                                      
+    *
+    *   Parallel algorithms that run on an existing
+    *   pool, built on ThreadPool::parallel_for.
+    *   The iterators must be random access.
+    */
+
+    /**
+    *   Number of elements of *a* among the first
+    *   *k* elements of the stable merge of *a*
+    *   and *b*. Used to split a merge in 
+    *   independent pieces.
+    */
+    template<class It, class C> size_t
+    _merge_corank(size_t k, It a, size_t na, It b, size_t nb, C& comp) {
+        size_t lo = k > nb ? k - nb : 0;
+        size_t hi = std::min(k, na);
+        while (lo < hi) {
+            size_t i = lo + (hi - lo) / 2;
+            size_t j = k - i;
+            if (j > 0 && !comp(*(b + (j - 1)), *(a + i))) lo = i + 1;
+            else hi = i;
+        }
+        return lo;
+    }
+
+    /**
+    *   One round of the merge sort: the sorted runs
+    *   of *src*, delimited by *bounds*, are merged 
+    *   pairwise into *dst*. Each merge is split in
+    *   pieces, so that the last rounds, with few
+    *   runs, still use every thread.
+    */
+    template<class Src, class Dst, class C> void
+    _merge_round(ThreadPool& tp, Src src, Dst dst, 
+        const std::vector<size_t>& bounds, size_t parts, C& comp) {
+        size_t runs = bounds.size() - 1;
+        size_t pairs = (runs + 1) / 2;
+        size_t pieces = std::max<size_t>(1, (2 * parts + pairs - 1) / pairs);
+        tp.parallel_for(size_t(0), pairs * pieces, 1, [&](size_t w) {
+            size_t p = w / pieces;
+            size_t piece = w % pieces;
+            size_t begin = bounds[2 * p];
+            size_t mid = bounds[std::min(2 * p + 1, runs)];
+            size_t end = bounds[std::min(2 * p + 2, runs)];
+            size_t na = mid - begin;
+            size_t nb = end - mid;
+            size_t k0 = (na + nb) * piece / pieces;
+            size_t k1 = (na + nb) * (piece + 1) / pieces;
+            size_t i0 = _merge_corank(k0, src + begin, na, src + mid, nb, comp);
+            size_t i1 = _merge_corank(k1, src + begin, na, src + mid, nb, comp);
+            std::merge(std::make_move_iterator(src + (begin + i0)), 
+                std::make_move_iterator(src + (begin + i1)),
+                std::make_move_iterator(src + (mid + k0 - i0)), 
+                std::make_move_iterator(src + (mid + k1 - i1)),
+                dst + (begin + k0), comp);
+        }, Partitioner::Dynamic);
+    }
+
+    /**
+    *   Sort [first, last) with *comp* on the pool.
+    *   The range is split in one block per thread,
+    *   the blocks are sorted with std::sort, than 
+    *   merged in rounds through a buffer of the 
+    *   same size. Like std::sort, it is not stable.
+    *   Small ranges are sorted by the caller.
+    */
+    template<class It, class C> void
+    parallel_sort(ThreadPool& tp, It first, It last, C comp) {
+        typedef typename std::iterator_traits<It>::value_type T;
+        size_t n = static_cast<size_t>(last - first);
+        size_t parts = static_cast<size_t>(std::max(0, tp.pool_size())) + 1;
+        size_t blocks = std::min(parts, n / 4096);
+        if (blocks < 2) {
+            std::sort(first, last, comp);
+            return;
+        }
+
+        std::vector<size_t> bounds(blocks + 1);
+        for (size_t b = 0; b <= blocks; ++b) bounds[b] = n * b / blocks;
+        tp.parallel_for(size_t(0), blocks, 1, [&](size_t b) {
+            std::sort(first + bounds[b], first + bounds[b + 1], comp);
+        }, Partitioner::Dynamic);
+
+        std::vector<T> buffer(n);
+        bool in_buffer = false;
+        while (bounds.size() > 2) {
+            if (in_buffer) _merge_round(tp, buffer.begin(), first, bounds, parts, comp);
+            else _merge_round(tp, first, buffer.begin(), bounds, parts, comp);
+            in_buffer = !in_buffer;
+            std::vector<size_t> next;
+            for (size_t i = 0; i < bounds.size(); i += 2) next.push_back(bounds[i]);
+            if (next.back() != n) next.push_back(n);
+            bounds.swap(next);
+        }
+        if (in_buffer) {
+            tp.parallel_for(size_t(0), n, [&](size_t b, size_t e) {
+                std::move(buffer.begin() + b, buffer.begin() + e, first + b);
+            });
+        }
+    }
+
+    /**/
+    template<class It> void
+    parallel_sort(ThreadPool& tp, It first, It last) {
+        typedef typename std::iterator_traits<It>::value_type T;
+        parallel_sort(tp, first, last, std::less<T>());
+    }
+
+    /**
+    *   Shared implementation of the scans: every
+    *   block is reduced, the block sums are scanned 
+    *   by the caller, than every block is scanned 
+    *   again starting from its offset.
+    *   *out* may be equal to *first*.
+    */
+    template<class It, class Out, class T, class Op> void
+    _parallel_scan(ThreadPool& tp, It first, It last, Out out, 
+        const T* init, Op& op, bool inclusive) {
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return;
+        size_t parts = static_cast<size_t>(std::max(0, tp.pool_size())) + 1;
+        size_t blocks = std::max<size_t>(1, std::min(parts, n / 4096));
+
+        std::vector<size_t> bounds(blocks + 1);
+        for (size_t b = 0; b <= blocks; ++b) bounds[b] = n * b / blocks;
+        std::vector<T> sums;
+        if (blocks > 1) {
+            sums.assign(blocks, T());
+            tp.parallel_for(size_t(0), blocks - 1, 1, [&](size_t b) {
+                It it = first + bounds[b];
+                T acc = *it;
+                for (++it; it != first + bounds[b + 1]; ++it) acc = op(acc, *it);
+                sums[b] = std::move(acc);
+            }, Partitioner::Dynamic);
+        }
+
+        /* offsets[b] is the prefix before block b */
+        std::vector<T> offsets;
+        offsets.reserve(blocks);
+        for (size_t b = 0; b < blocks; ++b) {
+            if (b == 0) { if (init) offsets.push_back(*init); else offsets.push_back(T()); }
+            else if (b == 1 && !init) offsets.push_back(sums[0]);
+            else offsets.push_back(op(offsets[b - 1], sums[b - 1]));
+        }
+
+        tp.parallel_for(size_t(0), blocks, 1, [&](size_t b) {
+            It it = first + bounds[b];
+            It end = first + bounds[b + 1];
+            Out o = out + bounds[b];
+            bool has_acc = b > 0 || init;
+            T acc = offsets[b];
+            for (; it != end; ++it, ++o) {
+                if (inclusive) {
+                    acc = has_acc ? op(acc, *it) : T(*it);
+                    has_acc = true;
+                    *o = acc;
+                } else {
+                    T x = *it;
+                    *o = acc;
+                    acc = op(acc, x);
+                }
+            }
+        }, Partitioner::Dynamic);
+    }
+
+    /**
+    *   Write in *out* the inclusive prefix of
+    *   [first, last) under the associative *op*:
+    *   out[i] = x[0] op ... op x[i].
+    *   *out* may be equal to *first*.
+    */
+    template<class It, class Out, class Op> Out
+    parallel_inclusive_scan(ThreadPool& tp, It first, It last, Out out, Op op) {
+        typedef typename std::iterator_traits<It>::value_type T;
+        _parallel_scan(tp, first, last, out, static_cast<const T*>(nullptr), op, true);
+        return out + (last - first);
+    }
+
+    /**/
+    template<class It, class Out> Out
+    parallel_inclusive_scan(ThreadPool& tp, It first, It last, Out out) {
+        typedef typename std::iterator_traits<It>::value_type T;
+        return parallel_inclusive_scan(tp, first, last, out, std::plus<T>());
+    }
+
+    /**
+    *   Write in *out* the exclusive prefix of
+    *   [first, last) under the associative *op*:
+    *   out[0] = init, out[i] = init op x[0] op ... op x[i - 1].
+    *   *out* may be equal to *first*.
+    */
+    template<class It, class Out, class T, class Op> Out
+    parallel_exclusive_scan(ThreadPool& tp, It first, It last, Out out, T init, Op op) {
+        _parallel_scan(tp, first, last, out, &init, op, false);
+        return out + (last - first);
+    }
+
+    /**/
+    template<class It, class Out, class T> Out
+    parallel_exclusive_scan(ThreadPool& tp, It first, It last, Out out, T init) {
+        return parallel_exclusive_scan(tp, first, last, out, init, std::plus<T>());
+    }
+
 
 }; /* Namespace end */
 